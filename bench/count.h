@@ -0,0 +1,52 @@
+#include <time.h>
+#include <unistd.h>
+
+static long bench_steps;
+static long bench_t0;
+static long bench_t1;
+
+static long bench_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+__attribute__((constructor)) static void bench_init(void) {
+    bench_t0 = bench_now();
+}
+
+static int bench_step(int op) {
+#ifdef BENCH_COUNT
+    bench_steps++;
+#endif
+    if (bench_t1 == 0)
+        bench_t1 = bench_now();
+    return op;
+}
+
+static void bench_push_long(char* buf, int* size, long x) {
+    char tmp[24];
+    int n = 0;
+    do {
+        tmp[n++] = '0' + x % 10;
+        x /= 10;
+    } while (x != 0);
+    while (n != 0)
+        buf[(*size)++] = tmp[--n];
+    buf[(*size)++] = ' ';
+}
+
+__attribute__((destructor)) static void bench_exit(void) {
+    long t2 = bench_now();
+    char buf[128];
+    int size = 0;
+    if (bench_t1 == 0)
+        bench_t1 = t2;
+    bench_push_long(buf, &size, bench_steps);
+    bench_push_long(buf, &size, bench_t1 - bench_t0);
+    bench_push_long(buf, &size, t2 - bench_t1);
+    buf[size - 1] = '\n';
+    write(3, buf, size);
+}
+
+#define BENCH_STEP(op) bench_step(op)
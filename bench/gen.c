@@ -0,0 +1,180 @@
+#include <stdbool.h>
+#include <unistd.h>
+
+#define BUF_SZ (1 << 16)
+
+enum shape {
+    SHAPE_FLAT,
+    SHAPE_NESTED,
+    SHAPE_CALLS,
+    SHAPE_EXPR,
+};
+
+struct gen {
+    enum shape shape;
+    int fn_size;
+    int stmt_size;
+    int depth;
+    char buf[BUF_SZ];
+    int size;
+};
+
+bool str_eq(const char* a, const char* b) {
+    for (; *a != '\0' && *a == *b; a++, b++) {
+    }
+    return *a == *b;
+}
+
+int str_to_int(const char* p) {
+    int x = 0;
+    for (; *p >= '0' && *p <= '9'; p++)
+        x = x * 10 + *p - '0';
+    return x;
+}
+
+void out_flush(struct gen* g) {
+    write(STDOUT_FILENO, g->buf, g->size);
+    g->size = 0;
+}
+
+void out_str(struct gen* g, const char* str) {
+    for (; *str != '\0'; str++) {
+        g->buf[g->size++] = *str;
+        if (g->size == BUF_SZ)
+            out_flush(g);
+    }
+}
+
+void out_int(struct gen* g, int x) {
+    char tmp[12];
+    int n = 0;
+    do {
+        tmp[n++] = '0' + x % 10;
+        x /= 10;
+    } while (x != 0);
+    while (n != 0) {
+        char s[2] = {tmp[--n], '\0'};
+        out_str(g, s);
+    }
+}
+
+void out_indent(struct gen* g, int level) {
+    for (int i = 0; i < level; i++)
+        out_str(g, "    ");
+}
+
+void gen_expr(struct gen* g, int depth, int j) {
+    if (depth == 0) {
+        out_str(g, j % 2 == 0 ? "a" : "b");
+        out_str(g, " + ");
+        out_int(g, j);
+        return;
+    }
+    out_str(g, "(");
+    gen_expr(g, depth - 1, j + 1);
+    out_str(g, depth % 2 == 0 ? ") * (" : ") - (");
+    gen_expr(g, depth - 1, j + 2);
+    out_str(g, ")");
+}
+
+void gen_stmt(struct gen* g, int fn, int j, int level) {
+    out_indent(g, level);
+    out_str(g, "&x");
+    out_int(g, j);
+    out_str(g, " = ");
+    if (g->shape == SHAPE_CALLS && fn != 0) {
+        out_str(g, "f");
+        out_int(g, (fn + j) % fn);
+        out_str(g, "(a, x");
+        out_int(g, j == 0 ? 0 : j - 1);
+        out_str(g, ")");
+    } else if (g->shape == SHAPE_EXPR) {
+        gen_expr(g, g->depth, j);
+    } else {
+        out_str(g, "a + ");
+        out_int(g, j);
+        out_str(g, " * b");
+    }
+    out_str(g, "\n");
+}
+
+void gen_nest(struct gen* g, int fn, int j, int level, int depth) {
+    if (depth == 0) {
+        gen_stmt(g, fn, j, level);
+        return;
+    }
+    out_indent(g, level);
+    out_str(g, depth % 2 == 0 ? "if (a < " : "loop (\n");
+    if (depth % 2 == 0) {
+        out_int(g, j);
+        out_str(g, ") (\n");
+    } else {
+        out_indent(g, level + 1);
+        out_str(g, "if (b == 0) (\n");
+        out_indent(g, level + 2);
+        out_str(g, "break\n");
+        out_indent(g, level + 1);
+        out_str(g, ")\n");
+    }
+    gen_nest(g, fn, j, level + 1, depth - 1);
+    if (depth % 2 == 1) {
+        out_indent(g, level + 1);
+        out_str(g, "&b = b - 1\n");
+    }
+    out_indent(g, level);
+    out_str(g, ")\n");
+}
+
+void gen_fn(struct gen* g, int fn) {
+    out_str(g, "fn f");
+    out_int(g, fn);
+    out_str(g, "(a, b) (\n");
+    for (int j = 0; j < g->stmt_size; j++) {
+        if (g->shape == SHAPE_NESTED)
+            gen_nest(g, fn, j, 1, g->depth);
+        else
+            gen_stmt(g, fn, j, 1);
+    }
+    out_str(g, "    return (x0)\n)\n\n");
+}
+
+void gen_script(struct gen* g) {
+    out_str(g, "main()\n1 = -1\n\n");
+    for (int i = 0; i < g->fn_size; i++)
+        gen_fn(g, i);
+    out_str(g, "fn main() (\n    &result = 0\n)\n");
+    out_flush(g);
+}
+
+void init_gen(struct gen* g, int argc, char** argv) {
+    g->shape = SHAPE_FLAT;
+    g->fn_size = 100;
+    g->stmt_size = 10;
+    g->depth = 2;
+    g->size = 0;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (str_eq(argv[i], "-f")) {
+            g->fn_size = str_to_int(argv[i + 1]);
+        } else if (str_eq(argv[i], "-s")) {
+            g->stmt_size = str_to_int(argv[i + 1]);
+        } else if (str_eq(argv[i], "-d")) {
+            g->depth = str_to_int(argv[i + 1]);
+        } else if (str_eq(argv[i], "-k")) {
+            if (str_eq(argv[i + 1], "nested"))
+                g->shape = SHAPE_NESTED;
+            else if (str_eq(argv[i + 1], "calls"))
+                g->shape = SHAPE_CALLS;
+            else if (str_eq(argv[i + 1], "expr"))
+                g->shape = SHAPE_EXPR;
+            else
+                g->shape = SHAPE_FLAT;
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+    static struct gen g;
+    init_gen(&g, argc, argv);
+    gen_script(&g);
+    return 0;
+}
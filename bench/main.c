@@ -0,0 +1,318 @@
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define PATH_SZ (1 << 10)
+#define BUF_SZ (1 << 16)
+#define RUN_MAX (1 << 8)
+
+struct engine {
+    const char* name;
+    const char* src;
+};
+
+struct sample {
+    long steps;
+    long compile_ns;
+    long run_ns;
+    long rss_kb;
+};
+
+struct bench {
+    const char* root;
+    const char* work;
+    const char* filter;
+    int runs;
+    int cpu;
+};
+
+static const struct engine engines[] = {
+    {"under500", "test/04.txt"},
+    {"v2", "test/05.txt"},
+    {"v3", "test/10"},
+    {"v4", "test/04"},
+};
+
+static const char* workloads[] = {"loop", "fib", "vec", "vecn", "stride", "print"};
+
+bool str_eq(const char* a, const char* b) {
+    for (; *a != '\0' && *a == *b; a++, b++) {
+    }
+    return *a == *b;
+}
+
+void path_join(char* dst, const char* a, const char* b, const char* c) {
+    int size = 0;
+    for (const char* s = a; *s != '\0'; s++)
+        dst[size++] = *s;
+    for (const char* s = b; s != NULL && *s != '\0'; s++)
+        dst[size++] = *s;
+    for (const char* s = c; s != NULL && *s != '\0'; s++)
+        dst[size++] = *s;
+    dst[size] = '\0';
+}
+
+long str_to_long(const char** p) {
+    long x = 0;
+    while (**p == ' ')
+        (*p)++;
+    for (; **p >= '0' && **p <= '9'; (*p)++)
+        x = x * 10 + **p - '0';
+    return x;
+}
+
+void out_push(char* buf, int* size, char ch) {
+    buf[(*size)++] = ch;
+}
+
+void out_str(char* buf, int* size, const char* str) {
+    for (; *str != '\0'; str++)
+        out_push(buf, size, *str);
+}
+
+void out_long(char* buf, int* size, long x) {
+    char tmp[24];
+    int n = 0;
+    if (x < 0) {
+        out_push(buf, size, '-');
+        x = -x;
+    }
+    do {
+        tmp[n++] = '0' + x % 10;
+        x /= 10;
+    } while (x != 0);
+    while (n != 0)
+        out_push(buf, size, tmp[--n]);
+}
+
+void out_field(char* buf, int* size, const char* key, long x) {
+    out_str(buf, size, ", \"");
+    out_str(buf, size, key);
+    out_str(buf, size, "\": ");
+    out_long(buf, size, x);
+}
+
+bool copy_file(const char* from, const char* to) {
+    static char buf[BUF_SZ];
+    int in = open(from, O_RDONLY);
+    if (in < 0)
+        return false;
+    int out = open(to, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    int n;
+    while ((n = read(in, buf, BUF_SZ)) > 0)
+        write(out, buf, n);
+    close(in);
+    close(out);
+    return true;
+}
+
+bool run_cc(const char* out, const char* src, const char* count_h, bool count) {
+    pid_t pid = fork();
+    if (pid == 0) {
+        if (count)
+            execlp("cc", "cc", "-O2", "-w", "-DBENCH_COUNT", "-include", count_h, "-o", out, src, (char*)NULL);
+        else
+            execlp("cc", "cc", "-O2", "-w", "-include", count_h, "-o", out, src, (char*)NULL);
+        _exit(127);
+    }
+    int status;
+    waitpid(pid, &status, 0);
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+bool run_vm(struct bench* b, const char* dir, const char* vm, struct sample* s) {
+    int fds[2];
+    pipe(fds);
+    pid_t pid = fork();
+    if (pid == 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(b->cpu, &set);
+        sched_setaffinity(0, sizeof(set), &set);
+        int null = open("/dev/null", O_RDWR);
+        dup2(null, STDIN_FILENO);
+        dup2(null, STDOUT_FILENO);
+        close(fds[0]);
+        dup2(fds[1], 3);
+        chdir(dir);
+        execl(vm, vm, (char*)NULL);
+        _exit(127);
+    }
+    close(fds[1]);
+    char buf[128];
+    int size = 0;
+    int n;
+    while (size < (int)sizeof(buf) - 1 && (n = read(fds[0], buf + size, sizeof(buf) - 1 - size)) > 0)
+        size += n;
+    buf[size] = '\0';
+    close(fds[0]);
+    int status;
+    struct rusage ru;
+    wait4(pid, &status, 0, &ru);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0 || size == 0)
+        return false;
+    const char* p = buf;
+    s->steps = str_to_long(&p);
+    s->compile_ns = str_to_long(&p);
+    s->run_ns = str_to_long(&p);
+    s->rss_kb = ru.ru_maxrss;
+    return true;
+}
+
+void remove_dir(const char* dir) {
+    pid_t pid = fork();
+    if (pid == 0) {
+        execlp("rm", "rm", "-rf", dir, (char*)NULL);
+        _exit(127);
+    }
+    waitpid(pid, NULL, 0);
+}
+
+long median(long* xs, int n) {
+    for (int i = 1; i < n; i++) {
+        long x = xs[i];
+        int j = i;
+        for (; j > 0 && xs[j - 1] > x; j--)
+            xs[j] = xs[j - 1];
+        xs[j] = x;
+    }
+    return n % 2 == 1 ? xs[n / 2] : (xs[n / 2 - 1] + xs[n / 2]) / 2;
+}
+
+void bench_workload(struct bench* b, const struct engine* e, const char* w, bool* first) {
+    char dir[PATH_SZ];
+    char from[PATH_SZ];
+    char to[PATH_SZ];
+    char vm[PATH_SZ];
+    char vm_count[PATH_SZ];
+    long compile_ns[RUN_MAX];
+    long run_ns[RUN_MAX];
+    long rss_kb = 0;
+    struct sample s;
+    path_join(dir, b->work, "/", e->name);
+    path_join(from, b->root, "/bench/", e->name);
+    path_join(from, from, "/", w);
+    path_join(to, dir, "/", e->src);
+    path_join(vm, dir, "/vm", NULL);
+    path_join(vm_count, dir, "/vm_count", NULL);
+    if (!copy_file(from, to))
+        return;
+    if (!run_vm(b, dir, vm_count, &s))
+        return;
+    long steps = s.steps;
+    int n = 0;
+    for (int i = 0; i < b->runs; i++) {
+        if (!run_vm(b, dir, vm, &s))
+            return;
+        compile_ns[n] = s.compile_ns;
+        run_ns[n++] = s.run_ns;
+        if (s.rss_kb > rss_kb)
+            rss_kb = s.rss_kb;
+    }
+    long run = median(run_ns, n);
+    char buf[BUF_SZ];
+    int size = 0;
+    out_str(buf, &size, *first ? "[\n" : ",\n");
+    out_str(buf, &size, "  {\"engine\": \"");
+    out_str(buf, &size, e->name);
+    out_str(buf, &size, "\", \"workload\": \"");
+    out_str(buf, &size, w);
+    out_push(buf, &size, '"');
+    out_field(buf, &size, "runs", n);
+    out_field(buf, &size, "insts", steps);
+    out_field(buf, &size, "compile_ns", median(compile_ns, n));
+    out_field(buf, &size, "run_ns", run);
+    out_str(buf, &size, ", \"ns_per_inst\": ");
+    if (steps == 0) {
+        out_str(buf, &size, "null");
+    } else {
+        long frac = run * 1000 / steps % 1000;
+        out_long(buf, &size, run / steps);
+        out_push(buf, &size, '.');
+        out_push(buf, &size, '0' + frac / 100);
+        out_push(buf, &size, '0' + frac / 10 % 10);
+        out_push(buf, &size, '0' + frac % 10);
+    }
+    out_field(buf, &size, "peak_rss_kb", rss_kb);
+    out_push(buf, &size, '}');
+    write(STDOUT_FILENO, buf, size);
+    *first = false;
+}
+
+void bench_engine(struct bench* b, const struct engine* e, bool* first) {
+    char dir[PATH_SZ];
+    char test[PATH_SZ];
+    char src[PATH_SZ];
+    char vm[PATH_SZ];
+    char count_h[PATH_SZ];
+    path_join(dir, b->work, "/", e->name);
+    path_join(test, dir, "/test", NULL);
+    path_join(src, b->root, "/", e->name);
+    path_join(src, src, "/main.c", NULL);
+    path_join(count_h, b->root, "/bench/count.h", NULL);
+    mkdir(dir, 0777);
+    mkdir(test, 0777);
+    path_join(vm, dir, "/vm", NULL);
+    if (!run_cc(vm, src, count_h, false))
+        return;
+    path_join(vm, dir, "/vm_count", NULL);
+    if (!run_cc(vm, src, count_h, true))
+        return;
+    for (int i = 0; i < (int)(sizeof(workloads) / sizeof(workloads[0])); i++) {
+        if (b->filter != NULL && !str_eq(b->filter, e->name) && !str_eq(b->filter, workloads[i]))
+            continue;
+        bench_workload(b, e, workloads[i], first);
+    }
+}
+
+void init_bench(struct bench* b, int argc, char** argv) {
+    static char root[PATH_SZ];
+    static char work[] = "/tmp/sxcbench.XXXXXX";
+    *b = (struct bench){.runs = 5, .cpu = 0};
+    for (int i = 1; i < argc; i++) {
+        const char* p = argv[i + 1];
+        if (str_eq(argv[i], "-n") && i + 1 < argc) {
+            b->runs = str_to_long(&p);
+            i++;
+        } else if (str_eq(argv[i], "-c") && i + 1 < argc) {
+            b->cpu = str_to_long(&p);
+            i++;
+        } else {
+            b->filter = argv[i];
+        }
+    }
+    if (b->runs < 1)
+        b->runs = 1;
+    if (b->runs > RUN_MAX)
+        b->runs = RUN_MAX;
+    getcwd(root, PATH_SZ);
+    b->root = root;
+    b->work = mkdtemp(work);
+}
+
+int main(int argc, char** argv) {
+    struct bench b;
+    bool first = true;
+    init_bench(&b, argc, argv);
+    if (b.work == NULL)
+        return 1;
+    for (int i = 0; i < (int)(sizeof(engines) / sizeof(engines[0])); i++) {
+        if (b.filter != NULL && !str_eq(b.filter, engines[i].name)) {
+            bool match = false;
+            for (int j = 0; j < (int)(sizeof(workloads) / sizeof(workloads[0])); j++)
+                match = match || str_eq(b.filter, workloads[j]);
+            if (!match)
+                continue;
+        }
+        bench_engine(&b, &engines[i], &first);
+    }
+    write(STDOUT_FILENO, first ? "[]\n" : "\n]\n", 3);
+    remove_dir(b.work);
+    return 0;
+}
@@ -8,6 +8,10 @@
 #define sxcscript_buf_capacity (1 << 10)
 #define sxcscript_global_capacity (1 << 8)
 
+#ifndef BENCH_STEP
+#define BENCH_STEP(op) (op)
+#endif
+
 enum bool {
     false = 0,
     true = 1,
@@ -368,7 +372,7 @@ void sxcscript_exec(struct sxcscript* sxcscript) {
     int32_t a2;
     int32_t a3;
     while (sxcscript->mem[sxcscript->mem[sxcscript_global_ip].val].kind != sxcscript_kind_null) {
-        switch (sxcscript->mem[sxcscript->mem[sxcscript_global_ip].val].kind) {
+        switch (BENCH_STEP(sxcscript->mem[sxcscript->mem[sxcscript_global_ip].val].kind)) {
             case sxcscript_kind_const_get:
                 (sxcscript->mem[sxcscript_global_ip].val)++;
                 sxcscript->mem[(sxcscript->mem[sxcscript_global_sp].val)++].val = sxcscript->mem[sxcscript->mem[sxcscript_global_ip].val].val;
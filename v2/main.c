@@ -9,6 +9,10 @@
 #define sxcscript_global_size (1 << 8)
 #define sxcscript_stack_size (1 << 8)
 
+#ifndef BENCH_STEP
+#define BENCH_STEP(op) (op)
+#endif
+
 enum bool {
     false = 0,
     true = 1,
@@ -408,7 +412,7 @@ void sxcscript_run(union sxcscript_mem* mem) {
     int a2;
     int a3;
     while (mem[mem[sxcscript_global_ip].val].kind != sxcscript_kind_null) {
-        switch (mem[mem[sxcscript_global_ip].val].kind) {
+        switch (BENCH_STEP(mem[mem[sxcscript_global_ip].val].kind)) {
             case sxcscript_kind_const_get:
                 (mem[sxcscript_global_ip].val)++;
                 mem[(mem[sxcscript_global_sp].val)++].val = mem[mem[sxcscript_global_ip].val].val;
@@ -10,6 +10,10 @@
 #define sxcscript_global_size (1 << 8)
 #define sxcscript_stack_size (1 << 10)
 
+#ifndef BENCH_STEP
+#define BENCH_STEP(op) (op)
+#endif
+
 enum bool {
     false = 0,
     true = 1,
@@ -479,7 +483,7 @@ void sxcscript_out(union sxcscript_mem* mem, char* buf) {
 void sxcscript_run(union sxcscript_mem* mem) {
     int result;
     while (mem[mem[sxcscript_global_ip].val].kind != sxcscript_kind_null) {
-        switch (mem[mem[sxcscript_global_ip].val].kind) {
+        switch (BENCH_STEP(mem[mem[sxcscript_global_ip].val].kind)) {
             case sxcscript_kind_null:
                 break;
             case sxcscript_kind_nop:
@@ -1,15 +1,66 @@
 #include <fcntl.h>
+#include <limits.h>
+#include <setjmp.h>
+#include <linux/perf_event.h>
+#include <signal.h>
 #include <stdbool.h>
+#include <sys/mman.h>
 #include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <time.h>
 #include <unistd.h>
 
 #define STACK_SZ (128 * 1024 * 1024)
 #define SRC "test/04"
 #define MEM_SZ (1 << 20)
+#define MEM_MAX (1 << 26)
+#define HEAP_CLASSES 31
 #define COMP_SZ (1 << 20)
 #define BUF_SZ (1 << 10)
+#define DUMP_SZ 200000
 #define GLOB_SZ (1 << 8)
 #define STK_SZ (1 << 10)
+#define NAME_SZ (1 << 6)
+#define FN_SZ (1 << 12)
+#define LINE_SZ (1 << 20)
+#define LINE_BLK (1 << 6)
+#define PROF_US 1000
+#define PROF_DEPTH (1 << 4)
+#define PROF_STACKS (1 << 12)
+#define INLINE_MAX 16
+#define TMP_FRAME (STK_SZ / 2)
+#define INLINE_DEPTH (1 << 6)
+#define INLINE_ARGS (1 << 4)
+#define INLINE_SITES (1 << 12)
+#define LOOP_EXPRS (1 << 8)
+#define LOOP_STEP_COST 6
+#define SSA_VALS (1 << 16)
+#define SSA_ARGS (1 << 18)
+#define SSA_BLOCKS (1 << 14)
+#define SSA_DEFS (1 << 17)
+#define SSA_DEPTH (1 << 8)
+#define SSA_LIVE (1 << 21)
+#define SSA_COPIES (1 << 8)
+#define SSA_STACK (2 * STK_SZ)
+#define GVN_MIN 5
+#define REG_STACK TMP_FRAME
+#define PGO_ENTS (1 << 15)
+#define PGO_HOT 16
+#define PGO_INLINE_SCALE 4
+#define PGO_TRIPS 2
+#define PGO_TEST_MAX 16
+#define VERIFY_DEPTH STK_SZ
+#define PAGE_SZ (1 << 12)
+#define PAGE_WORDS (PAGE_SZ / (int)sizeof(union mem))
+#define SMALL_SZ (1 << 15)
+#define MATCH_SZ (1 << 15)
+
+// bench/count.h defines this to count and time dispatched instructions.
+#ifndef BENCH_STEP
+#define BENCH_STEP(op) (op)
+#endif
 
 enum op {
     OP_NULL,
@@ -39,6 +90,79 @@ enum op {
     OP_SVC,
     OP_LABEL,
     OP_LABEL_FNEND,
+    OP_VEC_INIT,
+    OP_VEC_SIZE,
+    OP_VEC_GET,
+    OP_VEC_SET,
+    OP_VEC_PUSH,
+    OP_VEC_POP,
+    OP_TAILCALL,
+    OP_MOV,
+    OP_MOVK,
+    OP_LEA,
+    OP_LOAD,
+    OP_STORE,
+    OP_ORK,
+    OP_ANDK,
+    OP_EQK,
+    OP_NEK,
+    OP_LTK,
+    OP_GTK,
+    OP_ADDK,
+    OP_SUBK,
+    OP_MULK,
+    OP_DIVK,
+    OP_MODK,
+    OP_JNZ,
+    OP_PROFILE,
+    OP_CHECK,
+    OP_LOAD8,
+    OP_STORE8,
+    OP_FADD,
+    OP_FSUB,
+    OP_FMUL,
+    OP_FDIV,
+    OP_FCMP,
+    OP_ITOF,
+    OP_FTOI,
+    OP_FOR,
+    OP_SWITCH,
+    OP_SEARCH,
+    OP_CASE,
+    OP_SVCK,
+    OP_PUSH_SMALL = 1 << 16,
+    OP_PUSH_LOCAL = OP_PUSH_SMALL + SMALL_SZ,
+};
+
+enum phase {
+    PHASE_READ,
+    PHASE_TOKENIZE,
+    PHASE_PARSE,
+    PHASE_ANALYZE,
+    PHASE_LINK,
+    PHASE_OUT,
+    PHASE_RUN,
+    PHASE_SZ,
+};
+
+enum counter {
+    CNT_CYCLES,
+    CNT_INSTS,
+    CNT_BRANCH_MISSES,
+    CNT_L1D_MISSES,
+    CNT_LLC_MISSES,
+    CNT_SZ,
+};
+
+enum err {
+    ERR_NONE,
+    ERR_VEC_RANGE,
+    ERR_STACK,
+    ERR_ADDR,
+    ERR_JUMP,
+    ERR_DIV,
+    ERR_OVERFLOW,
+    ERR_CODE,
 };
 
 enum global {
@@ -64,13 +188,509 @@ struct label {
     struct token* token;
     int arg_size;
     int inst_index;
+    struct token* origin;
+    int ordinal;
 };
 
 union mem {
     enum op op;
     int val;
+    float num;
+};
+
+struct config {
+    const char* src;
+    bool prof;
+    bool lines;
+    bool stats;
+    bool perf;
+    bool inline_report;
+    bool no_tail;
+    bool no_loops;
+    bool no_ssa;
+    bool checked;
+    bool verify;
+    bool packed;
+    bool compact;
+    bool huge;
+    int mem;
+    int inline_max;
+    const char* emit_c;
+    const char* profile_in;
+    const char* profile_out;
+};
+
+struct stats {
+    long ns[PHASE_SZ];
+    long counts[PHASE_SZ][CNT_SZ];
+    long last[CNT_SZ];
+    int bytes;
+    int tokens;
+    int nodes;
+    int labels;
+    int locals;
+    int inlined;
+    int ssa_fns;
+    int gvn;
+    int dce;
+    int tail_calls;
+    int hoisted;
+    int reduced;
+    int laid_out;
+    int verified;
+    int insts;
+    int code_bytes;
+    long mem_words;
+    long mem_pages;
+    long heap_allocs;
+    long heap_frees;
+    long heap_peak;
+    long heap_words;
+};
+
+struct func {
+    char name[NAME_SZ];
+    int inst_index;
+};
+
+struct line {
+    int inst_index;
+    int line;
+    int col;
+};
+
+struct line_chk {
+    struct line line;
+    int pos;
+};
+
+struct debug {
+    struct func funcs[FN_SZ];
+    int func_size;
+    unsigned char lines[LINE_SZ];
+    int line_size;
+    int line_count;
+    struct line line_last;
+    struct line_chk chks[LINE_SZ / LINE_BLK];
+    int chk_size;
+};
+
+struct prof_stack {
+    int count;
+    int size;
+    bool cut;
+    int ip[PROF_DEPTH];
+};
+
+struct prof {
+    union mem* mem;
+    struct debug* debug;
+    int base;
+    int dropped;
+    int total;
+    struct prof_stack stacks[PROF_STACKS];
+    long last[CNT_SZ];
+    long func_counts[FN_SZ + 1][CNT_SZ];
+    int func_samples[FN_SZ + 1];
+};
+
+struct perf {
+    bool on;
+    int fd[CNT_SZ];
+};
+
+struct inline_fn {
+    int start;
+    int end;
+    int locals;
+    int arg_size;
+    bool ok;
+    bool hot;
+    bool push_zero;
+};
+
+struct inline_site {
+    int caller;
+    int callee;
+    struct token* token;
+};
+
+struct inliner {
+    struct node out[COMP_SZ / sizeof(struct node)];
+    struct node tail[COMP_SZ / sizeof(struct node)];
+    int out_pos[COMP_SZ / sizeof(struct node)];
+    int seg_slots[COMP_SZ / sizeof(struct node)];
+    struct inline_fn fns[COMP_SZ / sizeof(struct label)];
+    int lab_depth[COMP_SZ / sizeof(struct label)];
+    int lab_map[COMP_SZ / sizeof(struct label)];
+    int lab_mark[COMP_SZ / sizeof(struct label)];
+    int mark;
+    int out_size;
+    struct inline_site sites[INLINE_SITES];
+    int site_size;
+};
+
+enum val_kind {
+    VAL_OTHER,
+    VAL_INV,
+    VAL_IV,
+};
+
+enum edit_kind {
+    EDIT_STEP,
+    EDIT_PRE,
+    EDIT_LOAD,
+};
+
+struct loop_val {
+    enum val_kind kind;
+    int start;
+    int iv;
+    int coef;
+    bool is_const;
+    int cval;
+    int end;
+};
+
+struct block {
+    int start;
+    int end;
+    int succ[2];
+    int succ_size;
+    int pred_min;
+    int pred_max;
+    int back;
+};
+
+struct loop_expr {
+    int start;
+    int end;
+    int slot;
+    int uses;
+    enum val_kind kind;
+    int iv;
+    int coef;
+};
+
+struct loop_cand {
+    int start;
+    int end;
+    int expr;
+};
+
+struct loop_edit {
+    enum edit_kind kind;
+    int pos;
+    int end;
+    int expr;
+    int slot;
+    int start;
+    int size;
+    int step;
+};
+
+struct loop_opt {
+    struct block blocks[COMP_SZ / sizeof(struct node)];
+    int block_size;
+    int lab_block[COMP_SZ / sizeof(struct label)];
+    int lab_depth[COMP_SZ / sizeof(struct label)];
+    int var_mark[2 * STK_SZ];
+    int var_writes[2 * STK_SZ];
+    int var_update[2 * STK_SZ];
+    int var_step[2 * STK_SZ];
+    int mark;
+    bool clobber;
+    struct loop_expr exprs[LOOP_EXPRS];
+    int steps[LOOP_EXPRS];
+    int expr_size;
+    struct loop_cand cands[LOOP_EXPRS];
+    int cand_size;
+    struct loop_edit edits[COMP_SZ / sizeof(struct node)];
+    int edit_start;
+    int edit_size;
+    struct node out[COMP_SZ / sizeof(struct node)];
+    int out_size;
+};
+
+enum ssa_kind {
+    SSA_NODE,
+    SSA_PHI,
+    SSA_READ,
+};
+
+struct ssa_val {
+    enum ssa_kind kind;
+    enum op op;
+    struct token* token;
+    int val;
+    int block;
+    int arg;
+    int arg_size;
+    int repl;
+    int var;
+    int next;
+    int inc;
+    int uses;
+    int user;
+    int cost;
+    int stack_args;
+    int first;
+    int addr_for;
+    int slot;
+    int slot_next;
+    int dense;
+    int pos;
+    int start;
+    int end;
+    bool live;
+    bool stacked;
+};
+
+struct ssa_block {
+    int start;
+    int end;
+    int succ[2];
+    int succ_size;
+    int pred;
+    int pred_size;
+    int net;
+    int low;
+    int depth;
+    int poison;
+    int head;
+    int tail;
+    int phis;
+    int incomplete;
+    int rpo;
+    int idom;
+    int child;
+    int sibling;
+    int pos_start;
+    int pos_end;
+    bool reach;
+    bool ragged;
+    bool filled;
+    bool sealed;
+};
+
+struct ssa_def {
+    int var;
+    int block;
+    int val;
+    int mark;
+};
+
+struct ssa_copy {
+    int dst;
+    int src;
+    int from;
+    bool done;
+};
+
+struct ssa {
+    struct ssa_val vals[SSA_VALS];
+    int val_size;
+    int args[SSA_ARGS];
+    int arg_size;
+    struct ssa_block blocks[SSA_BLOCKS];
+    int block_size;
+    int preds[2 * SSA_BLOCKS];
+    int order[SSA_BLOCKS];
+    int order_size;
+    int lab_block[COMP_SZ / sizeof(struct label)];
+    int lab_mark[COMP_SZ / sizeof(struct label)];
+    struct ssa_def defs[SSA_DEFS];
+    int def_size;
+    int gvn[SSA_DEFS];
+    int gvn_log[SSA_VALS];
+    int gvn_size;
+    int mark;
+    bool promote[2 * STK_SZ];
+    int stack[SSA_DEPTH];
+    int entry_head;
+    int entry_tail;
+    int dense[SSA_VALS];
+    int dense_size;
+    int words;
+    unsigned long live[SSA_LIVE];
+    int active[SSA_VALS];
+    int free_slots[TMP_FRAME];
+    int slot_head[2 * STK_SZ];
+    int scratch;
+    struct ssa_copy copies[SSA_COPIES];
+    bool fail;
+    bool full;
+    int merged;
+    int removed;
+    struct node out[COMP_SZ / sizeof(struct node)];
+    int out_size;
+};
+
+enum reg_kind {
+    REG_TEMP,
+    REG_CONST,
+    REG_LOCAL,
+    REG_ADDR,
+};
+
+struct reg_val {
+    enum reg_kind kind;
+    int val;
+};
+
+struct reg_gen {
+    union mem* mem;
+    union mem* iptr;
+    union mem* last;
+    struct label* labels;
+    struct debug* debug;
+    const char* src;
+    const char* cur;
+    struct token* tok;
+    struct line pos;
+    struct reg_val stack[STK_SZ];
+    int depth;
+    bool reach;
+    int lab_depth[COMP_SZ / sizeof(struct label)];
+};
+
+enum pgo_kind {
+    PGO_CALL,
+    PGO_LABEL,
+};
+
+enum pgo_edge {
+    PGO_TAKEN,
+    PGO_FALL,
+    PGO_BACK,
+    PGO_BACK_FALL,
+    PGO_COUNTS,
+};
+
+struct pgo_site {
+    int ip;
+    int word;
+    enum pgo_kind kind;
+    struct token* origin;
+    int ordinal;
+    int ent;
+};
+
+struct pgo_ent {
+    enum pgo_kind kind;
+    char name[NAME_SZ];
+    int off;
+    int ordinal;
+    long n[PGO_COUNTS];
+    bool used;
+};
+
+struct pgo {
+    bool on;
+    bool loaded;
+    const char* src;
+    struct token* fns[FN_SZ];
+    int fn_size;
+    struct pgo_site sites[COMP_SZ / sizeof(struct node)];
+    int site_size;
+    struct pgo_ent ents[PGO_ENTS];
+    int ent_size;
+    long calls;
+    long count[MEM_SZ];
+    long taken[MEM_SZ];
+};
+
+struct layout {
+    struct node out[COMP_SZ / sizeof(struct node)];
+    int out_size;
+    struct node cold[COMP_SZ / sizeof(struct node)];
+    int cold_size;
+    int moved[COMP_SZ / sizeof(struct node)];
+    int rot_start[COMP_SZ / sizeof(struct label)];
+    int rot_test[COMP_SZ / sizeof(struct label)];
+    int lab_mark[COMP_SZ / sizeof(struct label)];
+    int mark;
+};
+
+// The arms of every match, sorted by key: match m has the keys and labels
+// from first[m] up to first[m] + size[m], and its default label after them.
+struct matches {
+    int first[MATCH_SZ];
+    int size[MATCH_SZ];
+    int key[MATCH_SZ];
+    int lab[MATCH_SZ];
+    int count;
+    int arm_count;
+};
+
+// The syntax error that stopped the parser, if any.
+struct syntax {
+    const char* why;
+    struct token* at;
+    jmp_buf env;
+};
+
+struct verifier {
+    int depth[MEM_SZ];
+    bool start[MEM_SZ];
+    int work[MEM_SZ];
+    int work_size;
+    int end;
+    const char* why;
+    int at;
 };
 
+struct arena {
+    union mem* base;
+    long words;
+};
+
+// cls holds the size class of the block starting at each word, negated once
+// freed and 0 where no block starts. It lives outside VM memory, so a script
+// cannot forge a block for svc 4 to free.
+struct heap {
+    int lo;
+    int top;
+    int free[HEAP_CLASSES];
+    signed char* cls;
+    long allocs;
+    long frees;
+    long live;
+    long peak;
+};
+
+struct guard {
+    sigjmp_buf env;
+    enum err err;
+    int code_hi;
+    int stack;
+};
+
+struct packed {
+    unsigned char code[MEM_SZ];
+    int at[MEM_SZ];
+    int word[MEM_SZ];
+    int size;
+};
+
+static struct prof prof;
+static struct arena arena;
+static struct guard guard;
+static struct heap heap;
+static struct perf perf;
+static struct inliner inliner;
+static struct loop_opt loop_opt;
+static struct ssa ssa;
+static struct reg_gen reg_gen;
+static struct pgo pgo;
+static struct layout layout;
+static struct matches matches;
+static struct syntax syntax;
+static struct verifier verifier;
+static struct packed packed __attribute__((aligned(PAGE_SZ)));
+
+int ssa_read(struct ssa* s, int var, int b);
+int inst_size(enum op op);
 void parse_expr(struct token** token_ptr, struct node** node_ptr, struct label* labels, int* lab_size, int lab_break, int lab_cont);
 
 bool is_num(const char* str) {
@@ -78,6 +698,12 @@ bool is_num(const char* str) {
     return ((ch >= '0' && ch <= '9') || ch == '-');
 }
 
+bool str_eq(const char* a, const char* b) {
+    for (; *a != '\0' && *a == *b; a++, b++) {
+    }
+    return *a == *b;
+}
+
 bool token_eq(struct token* a, struct token* b) {
     if (a->size != b->size)
         return false;
@@ -98,21 +724,55 @@ bool token_eq_str(struct token* a, const char* b) {
     return true;
 }
 
+int str_to_int(const char* p) {
+    int x = 0;
+    for (; *p >= '0' && *p <= '9'; p++)
+        x = x * 10 + *p - '0';
+    return x;
+}
+
+// A literal with a fraction, like 1.5, is a float and gives its bits.
 int token_to_int(struct token* token) {
     bool neg = token->data[0] == '-';
     int i = neg ? 1 : 0;
     int ret = 0;
+    double scale = 0;
+    double num = 0;
     for (; i < token->size; i++) {
-        ret = ret * 10 + token->data[i] - '0';
+        if (token->data[i] == '.')
+            scale = 1;
+        else if (scale == 0)
+            ret = ret * 10 + token->data[i] - '0';
+        else
+            num += (token->data[i] - '0') * (scale /= 10);
     }
+    if (scale != 0)
+        return (union mem){.num = neg ? -(ret + num) : ret + num}.val;
     return neg ? -ret : ret;
 }
 
-void read_file(char* dst) {
-    int fd = open(SRC, O_RDONLY);
-    int n = read(fd, dst, COMP_SZ);
+// Float to int conversion for ftoi, which truncates and saturates instead of
+// leaving NaN and out-of-range values undefined.
+int float_to_int(float x) {
+    if (x != x)
+        return 0;
+    if (x >= 2147483648.0f)
+        return INT_MAX;
+    return x <= -2147483648.0f ? INT_MIN : (int)x;
+}
+
+// Returns -1, leaving dst empty, when path cannot be opened.
+int read_file(const char* path, char* dst) {
+    int fd = open(path, O_RDONLY);
+    dst[0] = '\0';
+    if (fd < 0)
+        return -1;
+    int n = read(fd, dst, COMP_SZ - 1);
+    if (n < 0)
+        n = 0;
     dst[n] = '\0';
     close(fd);
+    return n;
 }
 
 void tokenize(const char* src, struct token* tokens) {
@@ -122,6 +782,8 @@ void tokenize(const char* src, struct token* tokens) {
         if (*p == ' ' || *p == '\n') {
             if (t->size != 0)
                 t++;
+        } else if (*p == '.' && p[1] >= '0' && p[1] <= '9' && t->size != 0 && is_num(t->data)) {
+            t->size++;
         } else if (*p == '(' || *p == ')' || *p == ',' ||
                    *p == '.' || *p == '*' || *p == '&') {
             if (t->size != 0)
@@ -143,7 +805,17 @@ void push_node(struct node** node_ptr, enum op op, struct token* token, int val)
     (*node_ptr)++;
 }
 
+// Records the error and leaves the parser through parse_tokens, so no caller
+// goes on reading tokens that were never meant as what it expects.
+void syntax_fail(struct token* at, const char* why) {
+    syntax.why = why;
+    syntax.at = at;
+    longjmp(syntax.env, 1);
+}
+
 void parse_primary(struct token** token_ptr, struct node** node_ptr, struct label* labels, int* lab_size, int lab_break, int lab_cont) {
+    if ((*token_ptr)->data == NULL)
+        syntax_fail(*token_ptr, "expected a value");
     if (token_eq_str(*token_ptr, "(")) {
         (*token_ptr)++;
         while (!token_eq_str(*token_ptr, ")")) {
@@ -162,9 +834,16 @@ void parse_primary(struct token** token_ptr, struct node** node_ptr, struct labe
     }
 }
 
+// svc(k, x) with a literal k runs service k on x directly, without going
+// through the IO global, and leaves that global as it was.
 void parse_postfix(struct token** token_ptr, struct node** node_ptr, struct label* labels, int* lab_size, int lab_break, int lab_cont) {
     struct token* start = *token_ptr;
-    if (token_eq_str((*token_ptr) + 1, "(")) {
+    if (token_eq_str(start, "svc") && token_eq_str(start + 1, "(") && is_num(start[2].data) && token_eq_str(start + 3, ",")) {
+        *token_ptr += 4;
+        parse_expr(token_ptr, node_ptr, labels, lab_size, lab_break, lab_cont);
+        (*token_ptr)++;
+        push_node(node_ptr, OP_SVCK, start, token_to_int(start + 2));
+    } else if (token_eq_str((*token_ptr) + 1, "(")) {
         (*token_ptr)++;
         parse_primary(token_ptr, node_ptr, labels, lab_size, lab_break, lab_cont);
         if (token_eq_str(start, "return"))
@@ -264,22 +943,71 @@ void parse_eq(struct token** token_ptr, struct node** node_ptr, struct label* la
     }
 }
 
+bool is_and(struct token* token) {
+    return token_eq_str(token, "&") && token_eq_str(token + 1, "&");
+}
+
+bool is_binop(struct token* token) {
+    static const char* ops[] = {"*", "/", "%", "+", "-", "<", ">", "==", "!=", "||", "="};
+    for (int i = 0; i < (int)(sizeof(ops) / sizeof(ops[0])); i++) {
+        if (token_eq_str(token, ops[i]))
+            return true;
+    }
+    return is_and(token);
+}
+
+// Labels remember the token they were made for and their rank among the
+// labels made for it, which names them in a profile across compilations.
+int new_label(struct label* labels, int* lab_size, struct token* origin) {
+    int l = (*lab_size)++;
+    int ordinal = l > 0 && labels[l - 1].origin == origin ? labels[l - 1].ordinal + 1 : 0;
+    labels[l] = (struct label){NULL, 0, 0, origin, ordinal};
+    return l;
+}
+
+void push_bool(struct node** node_ptr, struct label* labels, int* lab_size, struct token* origin, int lab_true, int lab_false) {
+    int lab_end = new_label(labels, lab_size, origin);
+    if (lab_true != -1)
+        push_node(node_ptr, OP_LABEL, NULL, lab_true);
+    push_node(node_ptr, OP_PUSH_CONST, NULL, 1);
+    push_node(node_ptr, OP_JMP, NULL, lab_end);
+    push_node(node_ptr, OP_LABEL, NULL, lab_false);
+    push_node(node_ptr, OP_PUSH_CONST, NULL, 0);
+    push_node(node_ptr, OP_LABEL, NULL, lab_end);
+}
+
 void parse_and(struct token** token_ptr, struct node** node_ptr, struct label* labels, int* lab_size, int lab_break, int lab_cont) {
     parse_eq(token_ptr, node_ptr, labels, lab_size, lab_break, lab_cont);
-    while (token_eq_str(*token_ptr, "&") && token_eq_str((*token_ptr) + 1, "&")) {
+    if (!is_and(*token_ptr))
+        return;
+    struct token* origin = *token_ptr;
+    int lab_false = new_label(labels, lab_size, origin);
+    push_node(node_ptr, OP_JZE, NULL, lab_false);
+    while (is_and(*token_ptr)) {
         *token_ptr += 2;
         parse_eq(token_ptr, node_ptr, labels, lab_size, lab_break, lab_cont);
-        push_node(node_ptr, OP_AND, NULL, 0);
+        push_node(node_ptr, OP_JZE, NULL, lab_false);
     }
+    push_bool(node_ptr, labels, lab_size, origin, -1, lab_false);
 }
 
 void parse_or(struct token** token_ptr, struct node** node_ptr, struct label* labels, int* lab_size, int lab_break, int lab_cont) {
     parse_and(token_ptr, node_ptr, labels, lab_size, lab_break, lab_cont);
+    if (!token_eq_str(*token_ptr, "||"))
+        return;
+    struct token* origin = *token_ptr;
+    int lab_true = new_label(labels, lab_size, origin);
+    int lab_false = new_label(labels, lab_size, origin);
     while (token_eq_str(*token_ptr, "||")) {
+        int lab_next = new_label(labels, lab_size, *token_ptr);
+        push_node(node_ptr, OP_JZE, NULL, lab_next);
+        push_node(node_ptr, OP_JMP, NULL, lab_true);
+        push_node(node_ptr, OP_LABEL, NULL, lab_next);
         (*token_ptr)++;
         parse_and(token_ptr, node_ptr, labels, lab_size, lab_break, lab_cont);
-        push_node(node_ptr, OP_OR, NULL, 0);
     }
+    push_node(node_ptr, OP_JZE, NULL, lab_false);
+    push_bool(node_ptr, labels, lab_size, origin, lab_true, lab_false);
 }
 
 void parse_assign(struct token** token_ptr, struct node** node_ptr, struct label* labels, int* lab_size, int lab_break, int lab_cont) {
@@ -291,13 +1019,217 @@ void parse_assign(struct token** token_ptr, struct node** node_ptr, struct label
     }
 }
 
+void parse_cond_or(struct token** token_ptr, struct node** node_ptr, struct label* labels, int* lab_size, int lab_break, int lab_cont, int lab_false);
+
+// Tries to parse a parenthesized condition as jumps. Gives back the tokens,
+// nodes and labels when the group turns out to be anything but a condition
+// followed by one of the tokens accepted by follow.
+bool parse_cond_group(struct token** token_ptr, struct node** node_ptr, struct label* labels, int* lab_size, int lab_break, int lab_cont, int lab_false, bool top) {
+    struct token* token_save = *token_ptr;
+    struct node* node_save = *node_ptr;
+    int lab_save = *lab_size;
+    int match_save = matches.count;
+    int arm_save = matches.arm_count;
+    if (!token_eq_str(*token_ptr, "("))
+        return false;
+    (*token_ptr)++;
+    parse_cond_or(token_ptr, node_ptr, labels, lab_size, lab_break, lab_cont, lab_false);
+    if (token_eq_str(*token_ptr, ")")) {
+        struct token* next = (*token_ptr) + 1;
+        if (top ? !is_binop(next) : (is_and(next) || token_eq_str(next, "||") || token_eq_str(next, ")"))) {
+            (*token_ptr)++;
+            return true;
+        }
+    }
+    *token_ptr = token_save;
+    *node_ptr = node_save;
+    *lab_size = lab_save;
+    matches.count = match_save;
+    matches.arm_count = arm_save;
+    return false;
+}
+
+void parse_cond_and(struct token** token_ptr, struct node** node_ptr, struct label* labels, int* lab_size, int lab_break, int lab_cont, int lab_false) {
+    while (true) {
+        if (!parse_cond_group(token_ptr, node_ptr, labels, lab_size, lab_break, lab_cont, lab_false, false)) {
+            parse_eq(token_ptr, node_ptr, labels, lab_size, lab_break, lab_cont);
+            push_node(node_ptr, OP_JZE, NULL, lab_false);
+        }
+        if (!is_and(*token_ptr))
+            break;
+        *token_ptr += 2;
+    }
+}
+
+void parse_cond_or(struct token** token_ptr, struct node** node_ptr, struct label* labels, int* lab_size, int lab_break, int lab_cont, int lab_false) {
+    int lab_true = -1;
+    while (true) {
+        struct node* start = *node_ptr;
+        int lab_next = new_label(labels, lab_size, *token_ptr);
+        parse_cond_and(token_ptr, node_ptr, labels, lab_size, lab_break, lab_cont, lab_next);
+        if (!token_eq_str(*token_ptr, "||")) {
+            for (struct node* n = start; n < *node_ptr; n++) {
+                if ((n->op == OP_JZE || n->op == OP_JMP) && n->val == lab_next)
+                    n->val = lab_false;
+            }
+            break;
+        }
+        if (lab_true == -1)
+            lab_true = new_label(labels, lab_size, *token_ptr);
+        push_node(node_ptr, OP_JMP, NULL, lab_true);
+        push_node(node_ptr, OP_LABEL, NULL, lab_next);
+        (*token_ptr)++;
+    }
+    if (lab_true != -1)
+        push_node(node_ptr, OP_LABEL, NULL, lab_true);
+}
+
+// Compiles an if condition straight into branches to lab_false, so && and ||
+// skip their right side and no boolean is materialized.
+void parse_cond(struct token** token_ptr, struct node** node_ptr, struct label* labels, int* lab_size, int lab_break, int lab_cont, int lab_false) {
+    if (parse_cond_group(token_ptr, node_ptr, labels, lab_size, lab_break, lab_cont, lab_false, true))
+        return;
+    parse_expr(token_ptr, node_ptr, labels, lab_size, lab_break, lab_cont);
+    push_node(node_ptr, OP_JZE, NULL, lab_false);
+}
+
+void push_counter(struct node** node_ptr, struct token* var) {
+    push_node(node_ptr, OP_PUSH_VARADDR, var, 0);
+    push_node(node_ptr, OP_GLOBAL_GET, NULL, 0);
+}
+
+// for i in a..b body runs body with i counting from a up to b, which is
+// read again before every trip. The bounds are a number, a name or a
+// parenthesized expression, so a name before the body is not a call.
+// continue goes to the increment. The step is written out as `&i = i + 1`
+// so every pass sees an ordinary loop, and to_instructions fuses it with
+// the jump back when it can.
+void parse_for(struct token** token_ptr, struct node** node_ptr, struct label* labels, int* lab_size) {
+    struct token* origin = *token_ptr;
+    struct token* var = origin + 1;
+    int lab_start = new_label(labels, lab_size, origin);
+    int lab_cont = new_label(labels, lab_size, origin);
+    int lab_end = new_label(labels, lab_size, origin);
+    if (var->data == NULL || !token_eq_str(origin + 2, "in"))
+        syntax_fail(origin + 2, "expected in after the for variable");
+    *token_ptr += 3;
+    push_node(node_ptr, OP_PUSH_VARADDR, var, 0);
+    parse_primary(token_ptr, node_ptr, labels, lab_size, lab_end, lab_cont);
+    push_node(node_ptr, OP_GLOBAL_SET, NULL, 0);
+    if (!token_eq_str(*token_ptr, ".") || !token_eq_str(*token_ptr + 1, "."))
+        syntax_fail(*token_ptr, "expected .. between the for bounds");
+    *token_ptr += 2;
+    push_node(node_ptr, OP_LABEL, NULL, lab_start);
+    push_counter(node_ptr, var);
+    parse_primary(token_ptr, node_ptr, labels, lab_size, lab_end, lab_cont);
+    push_node(node_ptr, OP_LT, NULL, 0);
+    push_node(node_ptr, OP_JZE, NULL, lab_end);
+    parse_expr(token_ptr, node_ptr, labels, lab_size, lab_end, lab_cont);
+    push_node(node_ptr, OP_LABEL, NULL, lab_cont);
+    push_node(node_ptr, OP_PUSH_VARADDR, var, 0);
+    push_counter(node_ptr, var);
+    push_node(node_ptr, OP_PUSH_CONST, NULL, 1);
+    push_node(node_ptr, OP_ADD, NULL, 0);
+    push_node(node_ptr, OP_GLOBAL_SET, NULL, 0);
+    push_node(node_ptr, OP_JMP, NULL, lab_start);
+    push_node(node_ptr, OP_LABEL, NULL, lab_end);
+}
+
+// Counts the arms of the match whose body starts at token, so they can have
+// their slots before nested matches take theirs. *end is left at the token
+// that closes the body.
+int match_arms(struct token* token, struct token** end) {
+    int depth = 0;
+    int count = 0;
+    for (; token->data != NULL && (depth != 0 || !token_eq_str(token, ")")); token++) {
+        if (token_eq_str(token, "("))
+            depth++;
+        else if (token_eq_str(token, ")"))
+            depth--;
+        else if (depth == 0 && token_eq_str(token, "=>"))
+            count++;
+    }
+    *end = token;
+    return count;
+}
+
+void match_add(int m, int key, int lab) {
+    struct matches* t = &matches;
+    int* keys = &t->key[t->first[m]];
+    int* labs = &t->lab[t->first[m]];
+    int i = t->size[m];
+    for (int j = 0; j < i; j++) {
+        if (keys[j] == key)
+            return;
+    }
+    for (; i > 0 && keys[i - 1] > key; i--) {
+        keys[i] = keys[i - 1];
+        labs[i] = labs[i - 1];
+    }
+    keys[i] = key;
+    labs[i] = lab;
+    t->size[m]++;
+}
+
+// match x (k => a, ..., _ => d) runs the arm whose constant key equals x, or
+// the default arm _, if any, when none does; the first of two equal keys
+// wins. x is a number, a name or a parenthesized expression, as in for.
+// The arms go into matches sorted, and OP_SWITCH names the match. A match
+// without its parentheses or an arm without its =>, a key that is not a
+// number, and a match that would overflow the tables are syntax errors, and
+// the parse stops there.
+void parse_match(struct token** token_ptr, struct node** node_ptr, struct label* labels, int* lab_size, int lab_break, int lab_cont) {
+    struct matches* t = &matches;
+    struct token* origin = *token_ptr;
+    struct token* end;
+    int lab_end = new_label(labels, lab_size, origin);
+    int lab_default = lab_end;
+    (*token_ptr)++;
+    parse_primary(token_ptr, node_ptr, labels, lab_size, lab_break, lab_cont);
+    if (!token_eq_str(*token_ptr, "("))
+        syntax_fail(*token_ptr, "expected ( after the match value");
+    (*token_ptr)++;
+    int arms = match_arms(*token_ptr, &end) + 1;
+    if (end->data == NULL)
+        syntax_fail(origin, "match without its closing )");
+    if (arms > MATCH_SZ - t->arm_count)
+        syntax_fail(origin, "too many match arms");
+    int m = t->count++;
+    push_node(node_ptr, OP_SWITCH, NULL, m);
+    t->first[m] = t->arm_count;
+    t->size[m] = 0;
+    t->arm_count += arms;
+    while (*token_ptr < end) {
+        struct token* key = *token_ptr;
+        if (!token_eq_str(key, "_") && !is_num(key->data))
+            syntax_fail(key, "match key is not a number");
+        if (!token_eq_str(key + 1, "=>"))
+            syntax_fail(key + 1, "expected => after the match key");
+        int lab = new_label(labels, lab_size, key);
+        if (token_eq_str(key, "_"))
+            lab_default = lab;
+        else
+            match_add(m, token_to_int(key), lab);
+        *token_ptr += 2;
+        push_node(node_ptr, OP_LABEL, NULL, lab);
+        parse_expr(token_ptr, node_ptr, labels, lab_size, lab_break, lab_cont);
+        push_node(node_ptr, OP_JMP, NULL, lab_end);
+        if (token_eq_str(*token_ptr, ","))
+            (*token_ptr)++;
+    }
+    if (*token_ptr != end)
+        syntax_fail(*token_ptr, "match arm runs past the closing )");
+    (*token_ptr)++;
+    t->lab[t->first[m] + t->size[m]] = lab_default;
+    push_node(node_ptr, OP_LABEL, NULL, lab_end);
+}
+
 void parse_expr(struct token** token_ptr, struct node** node_ptr, struct label* labels, int* lab_size, int lab_break, int lab_cont) {
     if (token_eq_str(*token_ptr, "if")) {
-        int lab_if = (*lab_size)++;
-        int lab_else = (*lab_size)++;
+        int lab_if = new_label(labels, lab_size, *token_ptr);
+        int lab_else = new_label(labels, lab_size, *token_ptr);
         (*token_ptr)++;
-        parse_expr(token_ptr, node_ptr, labels, lab_size, lab_break, lab_cont);
-        push_node(node_ptr, OP_JZE, NULL, lab_if);
+        parse_cond(token_ptr, node_ptr, labels, lab_size, lab_break, lab_cont, lab_if);
         parse_expr(token_ptr, node_ptr, labels, lab_size, lab_break, lab_cont);
         if (token_eq_str(*token_ptr, "else")) {
             (*token_ptr)++;
@@ -309,13 +1241,17 @@ void parse_expr(struct token** token_ptr, struct node** node_ptr, struct label*
             push_node(node_ptr, OP_LABEL, NULL, lab_if);
         }
     } else if (token_eq_str(*token_ptr, "loop")) {
-        int lab_start = (*lab_size)++;
-        int lab_end = (*lab_size)++;
+        int lab_start = new_label(labels, lab_size, *token_ptr);
+        int lab_end = new_label(labels, lab_size, *token_ptr);
         (*token_ptr)++;
         push_node(node_ptr, OP_LABEL, NULL, lab_start);
         parse_expr(token_ptr, node_ptr, labels, lab_size, lab_end, lab_start);
         push_node(node_ptr, OP_JMP, NULL, lab_start);
         push_node(node_ptr, OP_LABEL, NULL, lab_end);
+    } else if (token_eq_str(*token_ptr, "for")) {
+        parse_for(token_ptr, node_ptr, labels, lab_size);
+    } else if (token_eq_str(*token_ptr, "match")) {
+        parse_match(token_ptr, node_ptr, labels, lab_size, lab_break, lab_cont);
     } else if (token_eq_str(*token_ptr, "break")) {
         (*token_ptr)++;
         push_node(node_ptr, OP_JMP, NULL, lab_break);
@@ -329,7 +1265,7 @@ void parse_expr(struct token** token_ptr, struct node** node_ptr, struct label*
 
 void parse_fn(struct token** token_ptr, struct node** node_ptr, struct label* labels, int* lab_size, int lab_break, int lab_cont) {
     if (token_eq_str(*token_ptr, "fn")) {
-        int lab_fn = (*lab_size)++;
+        int lab_fn = new_label(labels, lab_size, *token_ptr);
         int arg_size = 0;
         (*token_ptr)++;
         labels[lab_fn].token = *token_ptr;
@@ -346,6 +1282,7 @@ void parse_fn(struct token** token_ptr, struct node** node_ptr, struct label* la
             arg_itr->val = -4 - i;
             arg_itr--;
         }
+        labels[lab_fn].arg_size = arg_size;
         (*token_ptr)++;
         push_node(node_ptr, OP_LABEL, NULL, lab_fn);
         push_node(node_ptr, OP_PUSH_VARADDR, NULL, -2);
@@ -365,14 +1302,17 @@ void parse_fn(struct token** token_ptr, struct node** node_ptr, struct label* la
 void parse_tokens(struct token* tokens, struct node* nodes, struct label* labels, int* lab_size) {
     struct token* token_ptr = tokens;
     struct node* node_ptr = nodes;
+    if (setjmp(syntax.env) != 0)
+        return;
     while (token_ptr->data != NULL) {
         parse_fn(&token_ptr, &node_ptr, labels, lab_size, -1, -1);
     }
 }
 
-void analyze_push(struct node* nodes, struct token** locals, int* offsets) {
+int analyze_push(struct node* nodes, struct token** locals, int* offsets) {
     int off = 0;
     int local_count = 0;
+    int total = 0;
     for (struct node* n = nodes; n->op != OP_NULL; n++) {
         if (n->op == OP_LABEL_FNEND) {
             off = 0;
@@ -392,6 +1332,7 @@ void analyze_push(struct node* nodes, struct token** locals, int* offsets) {
                     else
                         offsets[local_count++] = off;
                     n->val = off++;
+                    total++;
                     break;
                 }
                 if (token_eq(locals[i], n->token)) {
@@ -401,6 +1342,7 @@ void analyze_push(struct node* nodes, struct token** locals, int* offsets) {
             }
         }
     }
+    return total;
 }
 
 int find_label(struct label* labels, int lab_size, struct node* n) {
@@ -413,91 +1355,4656 @@ int find_label(struct label* labels, int lab_size, struct node* n) {
     return -1;
 }
 
-void to_instructions(union mem* mem, struct node* nodes, struct label* labels, int* lab_size) {
-    union mem* iptr = mem + GLOB_SZ;
-    for (struct node* n = nodes; n->op != OP_NULL; n++) {
-        if (n->op == OP_LABEL) {
-            labels[n->val].inst_index = iptr - mem;
-        } else if (n->op == OP_PUSH_CONST || n->op == OP_PUSH_VARADDR || n->op == OP_JMP || n->op == OP_JZE) {
-            *(iptr++) = (union mem){.op = n->op};
-            *(iptr++) = (union mem){.val = n->val};
-        } else if (n->op == OP_CALL) {
-            *(iptr++) = (union mem){.op = n->op};
-            *(iptr++) = (union mem){.val = find_label(labels, *lab_size, n)};
-        } else if (n->op == OP_NOP) {
-            continue;
-        } else {
-            *(iptr++) = (union mem){.op = n->op};
-        }
+// Profile entries are keyed by the enclosing function's name and the byte
+// offset of the site from that name, so a profile still lines up after edits
+// to other functions and after inlining copies a site elsewhere.
+void pgo_init(struct label* labels, int lab_size, const char* src) {
+    pgo.src = src;
+    pgo.fn_size = 0;
+    for (int i = 0; i < lab_size && pgo.fn_size < FN_SZ; i++) {
+        if (labels[i].token != NULL)
+            pgo.fns[pgo.fn_size++] = labels[i].token;
     }
-    mem[GLOBAL_IP].val = GLOB_SZ;
-    mem[GLOBAL_BP].val = iptr - mem;
-    mem[GLOBAL_SP].val = (iptr - mem) + STK_SZ;
 }
 
-void analyze_script(union mem* mem, struct node* nodes, struct token** locals, int* offsets, struct label* labels, int* lab_size) {
-    analyze_push(nodes, locals, offsets);
-    to_instructions(mem, nodes, labels, lab_size);
+int pgo_fn(struct token* token) {
+    int lo = 0;
+    int hi = pgo.fn_size;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (pgo.fns[mid]->data <= token->data)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo - 1;
 }
 
-void link_instructions(union mem* mem, struct label* labels) {
-    for (union mem* inst = mem + GLOB_SZ; inst->op != OP_NULL; inst++) {
-        if (inst->op == OP_JMP || inst->op == OP_JZE || inst->op == OP_CALL) {
-            inst++;
-            inst->val = labels[inst->val].inst_index;
-        } else if (inst->op == OP_PUSH_CONST || inst->op == OP_PUSH_VARADDR) {
-            inst++;
+struct pgo_ent* pgo_find(enum pgo_kind kind, const char* name, int off, int ordinal, bool add) {
+    unsigned h = kind * 31 + off * 131 + ordinal * 8191;
+    for (const char* c = name; *c != '\0'; c++)
+        h = h * 33 + *c;
+    for (int i = 0; i < PGO_ENTS; i++) {
+        struct pgo_ent* e = &pgo.ents[(h + i) % PGO_ENTS];
+        if (!e->used) {
+            if (!add || pgo.ent_size >= PGO_ENTS / 2)
+                return NULL;
+            *e = (struct pgo_ent){kind, "", off, ordinal, {0}, true};
+            for (int j = 0; name[j] != '\0'; j++)
+                e->name[j] = name[j];
+            pgo.ent_size++;
+            return e;
         }
+        if (e->kind == kind && e->off == off && e->ordinal == ordinal && str_eq(e->name, name))
+            return e;
     }
+    return NULL;
 }
 
-void out_push(char* buf, int* size, char ch) {
-    buf[(*size)++] = ch;
+struct pgo_ent* pgo_key(enum pgo_kind kind, struct token* origin, int ordinal, bool add) {
+    char name[NAME_SZ] = "(top)";
+    const char* base = pgo.src;
+    if (origin == NULL)
+        return NULL;
+    int f = pgo_fn(origin);
+    if (f != -1) {
+        int n = pgo.fns[f]->size < NAME_SZ - 1 ? pgo.fns[f]->size : NAME_SZ - 1;
+        for (int j = 0; j < n; j++)
+            name[j] = pgo.fns[f]->data[j];
+        name[n] = '\0';
+        base = pgo.fns[f]->data;
+    }
+    return pgo_find(kind, name, origin->data - base, ordinal, add);
 }
 
-void out_memory(union mem* mem, char* buf) {
-    int fd = open("Scratch.txt", O_WRONLY | O_CREAT | O_TRUNC, 0666);
-    int size = 0;
-    for (int i = 1; i < 200000; i++) {
-        int x = mem[i].val;
-        int m = 1000000000;
-        if (x == 0) {
-            out_push(buf, &size, '0');
-            out_push(buf, &size, '\n');
+long pgo_label(struct label* labels, int lab, enum pgo_edge c) {
+    struct pgo_ent* e = pgo_key(PGO_LABEL, labels[lab].origin, labels[lab].ordinal, false);
+    return e == NULL ? 0 : e->n[c];
+}
+
+// A call site is hot when it made at least 1/PGO_HOT of all calls.
+bool pgo_hot(struct token* call) {
+    struct pgo_ent* e = pgo.loaded ? pgo_key(PGO_CALL, call, 0, false) : NULL;
+    return e != NULL && e->n[PGO_TAKEN] > 0 && e->n[PGO_TAKEN] * PGO_HOT >= pgo.calls;
+}
+
+// Remembers a branch or call emitted at ip while the tokens naming it are
+// still around. word is the operand holding a branch target. Under
+// --profile-out each site is preceded by OP_PROFILE, which counts it, so runs
+// without a profile pay nothing.
+void pgo_site(int ip, int word, enum pgo_kind kind, struct token* origin, int ordinal) {
+    if (origin == NULL || pgo.site_size == (int)(COMP_SZ / sizeof(struct node)))
+        return;
+    pgo.sites[pgo.site_size++] = (struct pgo_site){ip, word, kind, origin, ordinal, -1};
+}
+
+void pgo_sites(void) {
+    for (int i = 0; i < PGO_ENTS; i++)
+        pgo.ents[i].used = false;
+    pgo.ent_size = 0;
+    for (int i = 0; i < pgo.site_size; i++) {
+        struct pgo_site* site = &pgo.sites[i];
+        struct pgo_ent* e = pgo_key(site->kind, site->origin, site->ordinal, true);
+        site->ent = e == NULL ? -1 : e - pgo.ents;
+    }
+}
+
+void pgo_count(int ip, bool taken) {
+    pgo.count[ip]++;
+    pgo.taken[ip] += taken;
+}
+
+void src_pos(const char* src, const char** cur, const char* p, struct line* pos) {
+    if (*cur == NULL) {
+        *cur = src;
+        pos->line = 1;
+    }
+    for (; *cur < p; (*cur)++) {
+        if (**cur == '\n')
+            pos->line++;
+    }
+    for (; *cur > p; (*cur)--) {
+        if ((*cur)[-1] == '\n')
+            pos->line--;
+    }
+    const char* start = p;
+    while (start > src && start[-1] != '\n')
+        start--;
+    pos->col = p - start + 1;
+}
+
+void line_push_uint(struct debug* debug, unsigned x) {
+    while (x >= 0x80 && debug->line_size < LINE_SZ) {
+        debug->lines[debug->line_size++] = (x & 0x7f) | 0x80;
+        x >>= 7;
+    }
+    if (debug->line_size < LINE_SZ)
+        debug->lines[debug->line_size++] = x;
+}
+
+unsigned line_pop_uint(struct debug* debug, int* pos) {
+    unsigned x = 0;
+    for (int shift = 0; *pos < debug->line_size; shift += 7) {
+        unsigned char b = debug->lines[(*pos)++];
+        x |= (unsigned)(b & 0x7f) << shift;
+        if ((b & 0x80) == 0)
+            break;
+    }
+    return x;
+}
+
+void init_lines(struct debug* debug) {
+    debug->line_size = 0;
+    debug->line_count = 0;
+    debug->chk_size = 0;
+    debug->line_last = (struct line){0, 0, 0};
+}
+
+void add_line(struct debug* debug, struct line* l) {
+    struct line* last = &debug->line_last;
+    int dl = l->line - last->line;
+    if (debug->line_count != 0 && dl == 0 && l->col == last->col)
+        return;
+    line_push_uint(debug, l->inst_index - last->inst_index);
+    line_push_uint(debug, dl < 0 ? (-dl << 1) - 1 : dl << 1);
+    line_push_uint(debug, l->col);
+    if (debug->line_count % LINE_BLK == 0)
+        debug->chks[debug->chk_size++] = (struct line_chk){*l, debug->line_size};
+    debug->line_count++;
+    *last = *l;
+}
+
+bool find_line(struct debug* debug, int ip, struct line* out) {
+    int lo = 0;
+    int hi = debug->chk_size;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (debug->chks[mid].line.inst_index <= ip)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo == 0)
+        return false;
+    struct line cur = debug->chks[lo - 1].line;
+    int pos = debug->chks[lo - 1].pos;
+    while (pos < debug->line_size) {
+        int next = pos;
+        struct line l = cur;
+        l.inst_index += line_pop_uint(debug, &next);
+        unsigned zl = line_pop_uint(debug, &next);
+        l.line += (zl & 1) ? -(int)((zl + 1) >> 1) : (int)(zl >> 1);
+        l.col = line_pop_uint(debug, &next);
+        if (l.inst_index > ip)
+            break;
+        cur = l;
+        pos = next;
+    }
+    *out = cur;
+    return true;
+}
+
+void analyze_primitive(struct node* nodes, struct label* labels, int lab_size) {
+    for (struct node* n = nodes; n->op != OP_NULL; n++) {
+        if (n->op != OP_CALL)
             continue;
-        }
-        if (x < 0) {
-            out_push(buf, &size, '-');
-            x = -x;
-        }
-        while (x / m == 0)
-            m /= 10;
-        while (m != 0) {
-            char ch = (x / m % 10) + '0';
-            out_push(buf, &size, ch);
-            m /= 10;
-        }
-        out_push(buf, &size, '\n');
+        n->val = find_label(labels, lab_size, n);
+        if (n->val != -1)
+            continue;
+        if (token_eq_str(n->token, "vec_init"))
+            n->op = OP_VEC_INIT;
+        else if (token_eq_str(n->token, "vec_size"))
+            n->op = OP_VEC_SIZE;
+        else if (token_eq_str(n->token, "vec_get"))
+            n->op = OP_VEC_GET;
+        else if (token_eq_str(n->token, "vec_set"))
+            n->op = OP_VEC_SET;
+        else if (token_eq_str(n->token, "vec_push"))
+            n->op = OP_VEC_PUSH;
+        else if (token_eq_str(n->token, "vec_pop"))
+            n->op = OP_VEC_POP;
+        else if (token_eq_str(n->token, "load8"))
+            n->op = OP_LOAD8;
+        else if (token_eq_str(n->token, "store8"))
+            n->op = OP_STORE8;
+        else if (token_eq_str(n->token, "fadd"))
+            n->op = OP_FADD;
+        else if (token_eq_str(n->token, "fsub"))
+            n->op = OP_FSUB;
+        else if (token_eq_str(n->token, "fmul"))
+            n->op = OP_FMUL;
+        else if (token_eq_str(n->token, "fdiv"))
+            n->op = OP_FDIV;
+        else if (token_eq_str(n->token, "fcmp"))
+            n->op = OP_FCMP;
+        else if (token_eq_str(n->token, "itof"))
+            n->op = OP_ITOF;
+        else if (token_eq_str(n->token, "ftoi"))
+            n->op = OP_FTOI;
     }
-    write(fd, buf, size);
-    close(fd);
 }
 
-void run_script(union mem* mem) {
-    int a1;
-    while (mem[mem[GLOBAL_IP].val].op != OP_NULL) {
-        switch (mem[mem[GLOBAL_IP].val].op) {
-            case OP_NULL:
-                break;
-            case OP_NOP:
-                break;
-            case OP_PUSH_CONST:
-                (mem[GLOBAL_IP].val)++;
-                mem[(mem[GLOBAL_SP].val)++].val = mem[mem[GLOBAL_IP].val].val;
-                break;
-            case OP_PUSH_VARADDR:
-                (mem[GLOBAL_IP].val)++;
-                mem[(mem[GLOBAL_SP].val)++].val = mem[GLOBAL_BP].val + mem[mem[GLOBAL_IP].val].val;
+int node_effect(struct node* n, struct label* labels) {
+    switch (n->op) {
+        case OP_PUSH_CONST:
+        case OP_PUSH_VARADDR:
+            return 1;
+        case OP_GLOBAL_SET:
+        case OP_VEC_SET:
+        case OP_STORE8:
+            return -2;
+        case OP_JZE:
+        case OP_JNZ:
+        case OP_SWITCH:
+        case OP_SEARCH:
+        case OP_OR:
+        case OP_AND:
+        case OP_EQ:
+        case OP_NE:
+        case OP_LT:
+        case OP_GT:
+        case OP_ADD:
+        case OP_SUB:
+        case OP_MUL:
+        case OP_DIV:
+        case OP_MOD:
+        case OP_VEC_GET:
+        case OP_VEC_PUSH:
+        case OP_LOAD8:
+        case OP_FADD:
+        case OP_FSUB:
+        case OP_FMUL:
+        case OP_FDIV:
+        case OP_FCMP:
+            return -1;
+        case OP_CALL:
+        case OP_TAILCALL:
+            return 1 - labels[n->val].arg_size;
+        default:
+            return 0;
+    }
+}
+
+int node_pops(struct node* n, struct label* labels) {
+    switch (n->op) {
+        case OP_GLOBAL_GET:
+        case OP_JZE:
+        case OP_JNZ:
+        case OP_SWITCH:
+        case OP_SEARCH:
+        case OP_RETURN:
+        case OP_SVC:
+        case OP_SVCK:
+        case OP_VEC_INIT:
+        case OP_VEC_SIZE:
+        case OP_VEC_POP:
+        case OP_ITOF:
+        case OP_FTOI:
+            return 1;
+        case OP_GLOBAL_SET:
+        case OP_OR:
+        case OP_AND:
+        case OP_EQ:
+        case OP_NE:
+        case OP_LT:
+        case OP_GT:
+        case OP_ADD:
+        case OP_SUB:
+        case OP_MUL:
+        case OP_DIV:
+        case OP_MOD:
+        case OP_VEC_GET:
+        case OP_VEC_PUSH:
+        case OP_LOAD8:
+        case OP_FADD:
+        case OP_FSUB:
+        case OP_FMUL:
+        case OP_FDIV:
+        case OP_FCMP:
+            return 2;
+        case OP_VEC_SET:
+        case OP_STORE8:
+            return 3;
+        case OP_CALL:
+        case OP_TAILCALL:
+            return labels[n->val].arg_size;
+        default:
+            return 0;
+    }
+}
+
+bool is_frame_reg(int addr) {
+    return addr == GLOBAL_IP || addr == GLOBAL_SP || addr == GLOBAL_BP;
+}
+
+// A body is inlinable when it makes no calls, never touches IP/SP/BP or its
+// own frame header directly, and every path reaches the end or a return with
+// a consistent stack depth, so the value it leaves can replace the call.
+bool inline_check(struct inliner* in, struct node* nodes, struct label* labels, struct inline_fn* f, int max) {
+    int consts[INLINE_DEPTH];
+    int depth = 0;
+    bool live = true;
+    if (f->end < f->start || f->end - f->start > max || f->arg_size > INLINE_ARGS)
+        return false;
+    in->mark++;
+    for (int i = f->start; i < f->end; i++) {
+        if (nodes[i].op == OP_LABEL) {
+            in->lab_mark[nodes[i].val] = in->mark;
+            in->lab_depth[nodes[i].val] = -1;
+        }
+    }
+    for (int i = f->start; i < f->end; i++) {
+        struct node* n = &nodes[i];
+        if (n->op == OP_LABEL) {
+            int* known = &in->lab_depth[n->val];
+            if (*known == -1 && !live)
+                return false;
+            if (*known != -1 && live && *known != depth)
+                return false;
+            if (*known != -1)
+                depth = *known;
+            *known = depth;
+            live = true;
+            for (int j = 0; j < depth; j++)
+                consts[j] = 0;
+            continue;
+        }
+        if (!live || n->op == OP_CALL || n->op == OP_SWITCH || n->op == OP_LABEL_FNEND)
+            return false;
+        if (n->op == OP_PUSH_VARADDR && n->val < 0 && (n->val > -4 || n->val < -3 - f->arg_size))
+            return false;
+        if (n->op == OP_GLOBAL_GET && depth >= 1 && is_frame_reg(consts[depth - 1]))
+            return false;
+        if (n->op == OP_GLOBAL_SET && depth >= 2 && is_frame_reg(consts[depth - 2]))
+            return false;
+        if (n->op == OP_RETURN) {
+            if (depth != 1)
+                return false;
+            live = false;
+            continue;
+        }
+        int effect = node_effect(n, labels);
+        depth += effect;
+        if (depth < 0 || depth > INLINE_DEPTH)
+            return false;
+        if (n->op == OP_JMP || n->op == OP_JZE) {
+            int* known = &in->lab_depth[n->val];
+            if (in->lab_mark[n->val] != in->mark || (*known != -1 && *known != depth))
+                return false;
+            *known = depth;
+            live = n->op == OP_JZE;
+        } else if (effect >= -1 && depth > 0) {
+            consts[depth - 1] = n->op == OP_PUSH_CONST ? n->val : 0;
+        }
+    }
+    if (live && depth > 1)
+        return false;
+    f->push_zero = live && depth == 0;
+    return true;
+}
+
+// Walks back from a call to find where each argument expression starts. Each
+// argument is the shortest run of nodes ending at the next boundary that nets
+// exactly one value.
+bool inline_args(struct node* nodes, int call, int arg_size, int* starts, struct label* labels) {
+    int j = call;
+    for (int a = arg_size - 1; a >= 0; a--) {
+        int sum = 0;
+        while (sum != 1) {
+            if (--j < 0)
+                return false;
+            enum op op = nodes[j].op;
+            if (op == OP_LABEL || op == OP_LABEL_FNEND || op == OP_JMP || op == OP_JZE || op == OP_SWITCH || op == OP_RETURN)
+                return false;
+            if (op == OP_CALL && nodes[j].val == -1)
+                return false;
+            sum += node_effect(&nodes[j], labels);
+        }
+        starts[a] = j;
+    }
+    starts[arg_size] = call;
+    return true;
+}
+
+int inline_label(struct inliner* in, struct label* labels, int* lab_size, int lab) {
+    if (lab == -1 || in->lab_mark[lab] != in->mark) {
+        int l = (*lab_size)++;
+        labels[l] = (struct label){NULL, 0, 0, NULL, 0};
+        if (lab == -1)
+            return l;
+        labels[l].origin = labels[lab].origin;
+        labels[l].ordinal = labels[lab].ordinal;
+        in->lab_mark[lab] = in->mark;
+        in->lab_map[lab] = l;
+    }
+    return in->lab_map[lab];
+}
+
+void inline_push(struct inliner* in, enum op op, struct token* token, int val) {
+    in->out[in->out_size++] = (struct node){op, token, val};
+}
+
+// Replaces the call at nodes[call] with the callee body. Arguments are stored
+// into fresh slots past the caller's locals, the callee's locals follow them,
+// and a return other than the last node becomes a jump to the continuation.
+bool inline_call(struct inliner* in, struct node* nodes, int call, int node_size, struct label* labels, int* lab_size, int* slot) {
+    int starts[INLINE_ARGS + 1];
+    if (nodes[call].val == -1)
+        return false;
+    if (!in->fns[nodes[call].val].ok && !(in->fns[nodes[call].val].hot && pgo_hot(nodes[call].token)))
+        return false;
+    struct inline_fn* f = &in->fns[nodes[call].val];
+    int base = *slot;
+    int arg_base = base + f->locals;
+    int grow = (f->end - f->start) + 2 * f->arg_size + 2;
+    if (arg_base + f->arg_size > TMP_FRAME)
+        return false;
+    if (in->out_size + grow + (node_size - call) >= (int)(COMP_SZ / sizeof(struct node)))
+        return false;
+    if (*lab_size + (f->end - f->start) + 1 > (int)(COMP_SZ / sizeof(struct label)))
+        return false;
+    if (!inline_args(nodes, call, f->arg_size, starts, labels))
+        return false;
+    int from = in->out_pos[starts[0]];
+    int tail = in->out_size - from;
+    for (int i = 0; i < tail; i++)
+        in->tail[i] = in->out[from + i];
+    in->out_size = from;
+    for (int a = 0; a < f->arg_size; a++) {
+        inline_push(in, OP_PUSH_VARADDR, NULL, arg_base + a);
+        for (int i = in->out_pos[starts[a]]; i < in->out_pos[starts[a + 1]]; i++)
+            in->out[in->out_size++] = in->tail[i - from];
+        inline_push(in, OP_GLOBAL_SET, NULL, 0);
+    }
+    in->mark++;
+    int lab_cont = -1;
+    for (int i = f->start; i < f->end; i++) {
+        struct node n = nodes[i];
+        if (n.op == OP_PUSH_VARADDR && n.val >= 0) {
+            n.val += base;
+        } else if (n.op == OP_PUSH_VARADDR) {
+            n.val = arg_base + f->arg_size - 1 - (-4 - n.val);
+        } else if (n.op == OP_LABEL || n.op == OP_JMP || n.op == OP_JZE) {
+            n.val = inline_label(in, labels, lab_size, n.val);
+        } else if (n.op == OP_RETURN) {
+            if (i == f->end - 1)
+                continue;
+            if (lab_cont == -1)
+                lab_cont = inline_label(in, labels, lab_size, -1);
+            n = (struct node){OP_JMP, n.token, lab_cont};
+        }
+        in->out[in->out_size++] = n;
+    }
+    if (f->push_zero)
+        inline_push(in, OP_PUSH_CONST, NULL, 0);
+    if (lab_cont != -1)
+        inline_push(in, OP_LABEL, NULL, lab_cont);
+    *slot = arg_base + f->arg_size;
+    return true;
+}
+
+// Substitutes the bodies of small leaf functions at their call sites. Runs on
+// resolved nodes, after analyze_push, so callee locals are plain frame offsets
+// that can be moved into the caller's frame without renaming. With a profile,
+// callees up to PGO_INLINE_SCALE times larger are inlined at hot sites too.
+int analyze_inline(struct node* nodes, struct label* labels, int* lab_size, int max) {
+    struct inliner* in = &inliner;
+    int seg = 0;
+    int top = 0;
+    int lab_fn = -1;
+    int node_size = 0;
+    in->site_size = 0;
+    if (max <= 0)
+        return 0;
+    for (int i = 0; i < *lab_size; i++)
+        in->fns[i] = (struct inline_fn){0};
+    for (; nodes[node_size].op != OP_NULL; node_size++) {
+        struct node* n = &nodes[node_size];
+        if (n->op == OP_PUSH_VARADDR && n->val >= top)
+            top = n->val + 1;
+        if (n->op == OP_LABEL && labels[n->val].token != NULL) {
+            lab_fn = n->val;
+            in->fns[lab_fn].start = node_size + 7;
+            in->fns[lab_fn].arg_size = labels[lab_fn].arg_size;
+        } else if (n->op == OP_LABEL_FNEND) {
+            if (lab_fn != -1) {
+                in->fns[lab_fn].end = node_size - 1;
+                in->fns[lab_fn].locals = top;
+            }
+            in->seg_slots[seg++] = top;
+            top = 0;
+            lab_fn = -1;
+        }
+    }
+    in->seg_slots[seg] = top;
+    for (int i = 0; i < *lab_size; i++) {
+        if (labels[i].token != NULL && in->fns[i].end != 0)
+            in->fns[i].ok = inline_check(in, nodes, labels, &in->fns[i], max);
+        if (pgo.loaded && !in->fns[i].ok && in->fns[i].end != 0)
+            in->fns[i].hot = inline_check(in, nodes, labels, &in->fns[i], max * PGO_INLINE_SCALE);
+    }
+
+    seg = 0;
+    lab_fn = -1;
+    int slot = in->seg_slots[0];
+    int sites = 0;
+    in->out_size = 0;
+    for (int i = 0; i < node_size; i++) {
+        struct node* n = &nodes[i];
+        in->out_pos[i] = in->out_size;
+        if (n->op == OP_LABEL && labels[n->val].token != NULL) {
+            lab_fn = n->val;
+        } else if (n->op == OP_LABEL_FNEND) {
+            slot = in->seg_slots[++seg];
+            lab_fn = -1;
+        } else if (n->op == OP_CALL && inline_call(in, nodes, i, node_size, labels, lab_size, &slot)) {
+            if (in->site_size < INLINE_SITES)
+                in->sites[in->site_size++] = (struct inline_site){lab_fn, n->val, n->token};
+            sites++;
+            continue;
+        }
+        in->out[in->out_size++] = *n;
+    }
+    for (int i = 0; i < in->out_size; i++)
+        nodes[i] = in->out[i];
+    nodes[in->out_size] = (struct node){OP_NULL, NULL, 0};
+    return sites;
+}
+
+// A frame address escapes when it is used as a value rather than loaded from
+// or stored to: passed to a call, stored, returned or used in arithmetic. A
+// function whose frame address escapes must keep its frame until it returns.
+// A call to an undefined function has no arity, so it is taken as escaping.
+bool frame_escapes(struct node* nodes, int start, int end, struct label* labels, int* lab_depth) {
+    bool addr[INLINE_DEPTH];
+    int depth = 0;
+    bool live = true;
+    for (int i = start; i < end; i++) {
+        if (nodes[i].op == OP_LABEL)
+            lab_depth[nodes[i].val] = -1;
+    }
+    for (int i = start; i < end; i++) {
+        struct node* n = &nodes[i];
+        if (n->op == OP_LABEL) {
+            if (!live && lab_depth[n->val] == -1)
+                return true;
+            if (!live)
+                depth = lab_depth[n->val];
+            live = true;
+            continue;
+        }
+        if (!live || (n->op == OP_RETURN && depth == 0)) {
+            live = false;
+            continue;
+        }
+        if (n->op == OP_CALL && n->val == -1)
+            return true;
+        int pops = node_pops(n, labels);
+        int pushes = pops + node_effect(n, labels);
+        if (pops > depth || depth - pops + pushes > INLINE_DEPTH)
+            return true;
+        bool use = n->op == OP_GLOBAL_GET || n->op == OP_SVC || n->op == OP_SVCK || (n->op >= OP_VEC_INIT && n->op <= OP_VEC_POP) || n->op == OP_LOAD8 || n->op == OP_STORE8;
+        depth -= pops;
+        for (int j = 0; j < pops; j++) {
+            if (addr[depth + j] && !use && !(n->op == OP_GLOBAL_SET && j == 0))
+                return true;
+        }
+        if (pushes > 0)
+            addr[depth] = n->op == OP_PUSH_VARADDR;
+        depth += pushes;
+        if ((n->op == OP_JMP || n->op == OP_JZE) && n->val >= 0)
+            lab_depth[n->val] = depth;
+        for (int k = 0; n->op == OP_SWITCH && k <= matches.size[n->val]; k++)
+            lab_depth[matches.lab[matches.first[n->val] + k]] = depth;
+        if (n->op == OP_JMP || n->op == OP_SWITCH || n->op == OP_RETURN)
+            live = false;
+    }
+    return false;
+}
+
+// Turns a call whose result is returned straight away into OP_TAILCALL, which
+// reuses the caller's frame. Only labels may sit between the call and the
+// return, and the caller must not have let a frame address escape.
+int analyze_tail(struct node* nodes, struct label* labels) {
+    static int lab_depth[COMP_SZ / sizeof(struct label)];
+    int start = -1;
+    int count = 0;
+    for (int i = 0; nodes[i].op != OP_NULL; i++) {
+        if (nodes[i].op == OP_LABEL && labels[nodes[i].val].token != NULL) {
+            start = i;
+            continue;
+        }
+        if (nodes[i].op != OP_LABEL_FNEND || start == -1)
+            continue;
+        if (!frame_escapes(nodes, start + 1, i, labels, lab_depth)) {
+            for (int j = start + 1; j < i; j++) {
+                if (nodes[j].op != OP_CALL || nodes[j].val == -1)
+                    continue;
+                int k = j + 1;
+                while (nodes[k].op == OP_LABEL || nodes[k].op == OP_NOP)
+                    k++;
+                if (nodes[k].op == OP_RETURN) {
+                    nodes[j].op = OP_TAILCALL;
+                    count++;
+                }
+            }
+        }
+        start = -1;
+    }
+    return count;
+}
+
+void layout_push(struct layout* ly, struct node n) {
+    ly->out[ly->out_size++] = n;
+}
+
+// Matches a loop whose head is a label-free exit test, LABEL s; T; JZE a;
+// JMP end; LABEL a, closed by JMP s; LABEL end, and whose profile shows it
+// going around at least PGO_TRIPS times per exit.
+bool layout_loop(struct node* nodes, struct label* labels, int i, int end, int* test) {
+    int t = i + 1;
+    while (t < end && t - i <= PGO_TEST_MAX) {
+        enum op op = nodes[t].op;
+        if (op == OP_LABEL || op == OP_LABEL_FNEND || op == OP_JMP || op == OP_JZE || op == OP_SWITCH || op == OP_RETURN || op == OP_TAILCALL)
+            break;
+        t++;
+    }
+    if (t == i + 1 || t + 2 >= end || nodes[t].op != OP_JZE || nodes[t + 1].op != OP_JMP)
+        return false;
+    int lab_start = nodes[i].val;
+    int lab_body = nodes[t].val;
+    int lab_end = nodes[t + 1].val;
+    if (nodes[t + 2].op != OP_LABEL || nodes[t + 2].val != lab_body || lab_end == lab_start)
+        return false;
+    int e = t + 3;
+    while (e + 1 < end && !(nodes[e].op == OP_JMP && nodes[e].val == lab_start && nodes[e + 1].op == OP_LABEL && nodes[e + 1].val == lab_end))
+        e++;
+    if (e + 1 >= end)
+        return false;
+    long iters = pgo_label(labels, lab_start, PGO_BACK) + pgo_label(labels, lab_body, PGO_BACK);
+    long exits = pgo_label(labels, lab_end, PGO_TAKEN) + pgo_label(labels, lab_start, PGO_BACK_FALL) + pgo_label(labels, lab_body, PGO_BACK_FALL);
+    *test = t;
+    return iters > 0 && iters + exits >= PGO_TRIPS * exits;
+}
+
+// Matches JZE a; JMP b; LABEL a where the profile says the jump to b is the
+// common case, so a single JNZ b saves a dispatch on it.
+bool layout_jump(struct layout* ly, struct node* nodes, struct label* labels, int i) {
+    if (nodes[i + 1].op != OP_JMP || nodes[i + 2].op != OP_LABEL || nodes[i + 2].val != nodes[i].val || ly->moved[i + 1] == ly->mark)
+        return false;
+    return pgo_label(labels, nodes[i].val, PGO_FALL) > pgo_label(labels, nodes[i].val, PGO_TAKEN);
+}
+
+// Matches JZE else; A; JMP end; LABEL else; C; LABEL end with a label-free C
+// that the profile says runs less often than A.
+bool layout_else(struct layout* ly, struct node* nodes, struct label* labels, int i, int end, int* k, int* m) {
+    int lab_else = nodes[i].val;
+    if (pgo_label(labels, lab_else, PGO_FALL) <= pgo_label(labels, lab_else, PGO_TAKEN))
+        return false;
+    for (*k = i + 2; *k < end && !(nodes[*k].op == OP_LABEL && nodes[*k].val == lab_else); (*k)++) {
+    }
+    if (*k >= end || ly->moved[*k] == ly->mark || ly->moved[*k - 1] == ly->mark || nodes[*k - 1].op != OP_JMP || nodes[*k - 1].val == lab_else)
+        return false;
+    for (*m = *k + 1; *m < end && nodes[*m].op != OP_LABEL && nodes[*m].op != OP_LABEL_FNEND; (*m)++) {
+    }
+    return *m < end && *m > *k + 1 && nodes[*m].op == OP_LABEL && nodes[*m].val == nodes[*k - 1].val;
+}
+
+// Uses a profile to lay out branches so the common path falls through. Hot
+// loops are rotated so that each trip ends in a copy of the exit test instead
+// of a jump back to it, a branch around a jump that is usually taken becomes
+// JNZ, and a cold else branch moves to the end of its function, which drops
+// the jump over it from the hot path. Without a profile nothing changes.
+int analyze_layout(struct node* nodes, struct label* labels) {
+    struct layout* ly = &layout;
+    int cap = COMP_SZ / sizeof(struct node);
+    int size = 0;
+    int count = 0;
+    bool in_fn = false;
+    if (!pgo.loaded)
+        return 0;
+    while (nodes[size].op != OP_NULL)
+        size++;
+    ly->mark++;
+    ly->out_size = 0;
+    ly->cold_size = 0;
+    for (int i = 0; i < size; i++) {
+        struct node n = nodes[i];
+        int t;
+        int k;
+        int m;
+        if (ly->moved[i] == ly->mark)
+            continue;
+        bool room = ly->out_size + ly->cold_size + (size - i) + PGO_TEST_MAX < cap;
+        if (n.op == OP_LABEL && labels[n.val].token != NULL) {
+            in_fn = true;
+        } else if (n.op == OP_LABEL_FNEND) {
+            for (int j = 0; j < ly->cold_size; j++)
+                layout_push(ly, ly->cold[j]);
+            ly->cold_size = 0;
+            in_fn = false;
+        } else if (n.op == OP_LABEL && in_fn && room && layout_loop(nodes, labels, i, size, &t)) {
+            ly->lab_mark[n.val] = ly->mark;
+            ly->rot_start[n.val] = i + 1;
+            ly->rot_test[n.val] = t;
+            for (int j = i; j < t; j++)
+                layout_push(ly, nodes[j]);
+            layout_push(ly, (struct node){OP_JNZ, nodes[t].token, nodes[t + 1].val});
+            layout_push(ly, nodes[t + 2]);
+            i = t + 2;
+            count++;
+            continue;
+        } else if (n.op == OP_JMP && room && ly->lab_mark[n.val] == ly->mark && nodes[i + 1].op == OP_LABEL && nodes[i + 1].val == nodes[ly->rot_test[n.val] + 1].val) {
+            for (int j = ly->rot_start[n.val]; j <= ly->rot_test[n.val]; j++)
+                layout_push(ly, nodes[j]);
+            continue;
+        } else if (n.op == OP_JZE && layout_jump(ly, nodes, labels, i)) {
+            layout_push(ly, (struct node){OP_JNZ, n.token, nodes[i + 1].val});
+            i++;
+            count++;
+            continue;
+        } else if (n.op == OP_JZE && in_fn && layout_else(ly, nodes, labels, i, size, &k, &m)) {
+            for (int j = k; j < m; j++) {
+                ly->cold[ly->cold_size++] = nodes[j];
+                ly->moved[j] = ly->mark;
+            }
+            ly->cold[ly->cold_size++] = nodes[k - 1];
+            ly->moved[k - 1] = ly->mark;
+            count++;
+        }
+        layout_push(ly, n);
+    }
+    for (int i = 0; i < ly->cold_size; i++)
+        layout_push(ly, ly->cold[i]);
+    for (int i = 0; i < ly->out_size; i++)
+        nodes[i] = ly->out[i];
+    nodes[ly->out_size] = (struct node){OP_NULL, NULL, 0};
+    return count;
+}
+
+int ssa_args(struct ssa* s, int size) {
+    if (s->arg_size + size > SSA_ARGS) {
+        s->fail = true;
+        return 0;
+    }
+    s->arg_size += size;
+    return s->arg_size - size;
+}
+
+// Value 0 is a spare handed out once the pools run out, with SSA_DEPTH
+// scratch operands, so a failing build can run to the end before it is
+// thrown away.
+int ssa_new(struct ssa* s, enum ssa_kind kind, enum op op, struct token* token, int val, int block, int arg_size) {
+    int arg = ssa_args(s, arg_size);
+    if (s->val_size == SSA_VALS)
+        s->fail = true;
+    if (s->fail)
+        return 0;
+    int v = s->val_size++;
+    s->vals[v] = (struct ssa_val){
+        .kind = kind,
+        .op = op,
+        .token = token,
+        .val = val,
+        .block = block,
+        .arg = arg,
+        .arg_size = arg_size,
+        .repl = -1,
+        .var = -1,
+        .next = -1,
+        .inc = -1,
+        .user = -1,
+        .first = -1,
+        .addr_for = -1,
+        .slot = -1,
+        .dense = -1,
+    };
+    return v;
+}
+
+void ssa_append(struct ssa* s, int b, int v) {
+    struct ssa_block* bl = &s->blocks[b];
+    if (s->fail)
+        return;
+    if (bl->tail == -1)
+        bl->head = v;
+    else
+        s->vals[bl->tail].next = v;
+    bl->tail = v;
+}
+
+int ssa_find(struct ssa* s, int v) {
+    int r = v;
+    while (s->vals[r].repl != -1)
+        r = s->vals[r].repl;
+    while (s->vals[v].repl != -1) {
+        int next = s->vals[v].repl;
+        s->vals[v].repl = r;
+        v = next;
+    }
+    return r;
+}
+
+// Looks through copies: a read stands for the value it reads.
+int ssa_base(struct ssa* s, int v) {
+    v = ssa_find(s, v);
+    while (s->vals[v].kind == SSA_READ)
+        v = ssa_find(s, s->args[s->vals[v].arg]);
+    return v;
+}
+
+struct ssa_def* ssa_def(struct ssa* s, int var, int block, bool add) {
+    static struct ssa_def spare;
+    unsigned h = ((unsigned)var * 2654435761u + (unsigned)block * 40503u) & (SSA_DEFS - 1);
+    for (;; h = (h + 1) & (SSA_DEFS - 1)) {
+        struct ssa_def* d = &s->defs[h];
+        if (d->mark == s->mark && d->var == var && d->block == block)
+            return d;
+        if (d->mark == s->mark)
+            continue;
+        if (!add)
+            return NULL;
+        if (++s->def_size > SSA_DEFS / 2) {
+            s->fail = true;
+            return &spare;
+        }
+        *d = (struct ssa_def){var, block, -1, s->mark};
+        return d;
+    }
+}
+
+bool ssa_term(struct ssa_val* x) {
+    return x->kind == SSA_NODE && (x->op == OP_JMP || x->op == OP_JZE || x->op == OP_RETURN);
+}
+
+bool ssa_result(struct ssa_val* x) {
+    return x->kind != SSA_NODE || !(ssa_term(x) || x->op == OP_GLOBAL_SET);
+}
+
+bool ssa_remat(struct ssa_val* x) {
+    return x->kind == SSA_READ || (x->kind == SSA_NODE && (x->op == OP_PUSH_CONST || x->op == OP_PUSH_VARADDR));
+}
+
+// The value a promoted local holds on entry. It stays in the local's frame
+// slot, since promoted locals are no longer stored to memory.
+bool ssa_entry(struct ssa_val* x) {
+    return x->kind == SSA_NODE && x->var != -1;
+}
+
+bool ssa_root(struct ssa_val* x) {
+    switch (x->op) {
+        case OP_GLOBAL_SET:
+        case OP_CALL:
+        case OP_SVC:
+        case OP_SVCK:
+        case OP_VEC_INIT:
+        case OP_VEC_SET:
+        case OP_VEC_PUSH:
+        case OP_VEC_POP:
+        case OP_STORE8:
+        case OP_JMP:
+        case OP_JZE:
+        case OP_RETURN:
+            return x->kind == SSA_NODE;
+        default:
+            return false;
+    }
+}
+
+bool ssa_skip(enum op op) {
+    return op == OP_LABEL || op == OP_NOP || op == OP_TEST01 || op == OP_TEST02 || op == OP_TEST03;
+}
+
+void ssa_visit(struct ssa* s, int b) {
+    struct ssa_block* bl = &s->blocks[b];
+    bl->reach = true;
+    for (int i = 0; i < bl->succ_size; i++) {
+        if (!s->blocks[bl->succ[i]].reach)
+            ssa_visit(s, bl->succ[i]);
+    }
+    s->order[s->order_size++] = b;
+}
+
+// Splits [start, end) into basic blocks, keeps the ones reachable from the
+// entry and orders them in reverse postorder. A block has at most two
+// successors, so a function with a match is not modeled.
+bool ssa_blocks(struct ssa* s, struct node* nodes, int start, int end) {
+    s->block_size = 0;
+    for (int i = start; i < end; i++) {
+        enum op prev = i == start ? OP_NULL : nodes[i - 1].op;
+        if (nodes[i].op == OP_SWITCH)
+            return false;
+        if (i == start || nodes[i].op == OP_LABEL || prev == OP_JMP || prev == OP_JZE || prev == OP_RETURN) {
+            if (s->block_size == SSA_BLOCKS)
+                return false;
+            if (s->block_size != 0)
+                s->blocks[s->block_size - 1].end = i;
+            s->blocks[s->block_size++] = (struct ssa_block){
+                .start = i,
+                .depth = -1,
+                .head = -1,
+                .tail = -1,
+                .phis = -1,
+                .incomplete = -1,
+                .rpo = -1,
+                .idom = -1,
+                .child = -1,
+                .sibling = -1,
+            };
+        }
+        if (nodes[i].op == OP_LABEL) {
+            s->lab_block[nodes[i].val] = s->block_size - 1;
+            s->lab_mark[nodes[i].val] = s->mark;
+        }
+    }
+    s->blocks[s->block_size - 1].end = end;
+    for (int i = 0; i < s->block_size; i++) {
+        struct ssa_block* bl = &s->blocks[i];
+        struct node* last = &nodes[bl->end - 1];
+        if (last->op == OP_JMP || last->op == OP_JZE) {
+            if (last->val < 0 || s->lab_mark[last->val] != s->mark)
+                return false;
+            bl->succ[bl->succ_size++] = s->lab_block[last->val];
+        }
+        if (last->op != OP_JMP && last->op != OP_RETURN && i + 1 < s->block_size)
+            bl->succ[bl->succ_size++] = i + 1;
+    }
+    s->order_size = 0;
+    ssa_visit(s, 0);
+    for (int i = 0; i < s->order_size / 2; i++) {
+        int t = s->order[i];
+        s->order[i] = s->order[s->order_size - 1 - i];
+        s->order[s->order_size - 1 - i] = t;
+    }
+    for (int i = 0; i < s->order_size; i++)
+        s->blocks[s->order[i]].rpo = i;
+    int pred = 0;
+    for (int i = 0; i < s->block_size; i++) {
+        for (int j = 0; s->blocks[i].reach && j < s->blocks[i].succ_size; j++)
+            s->blocks[s->blocks[i].succ[j]].pred_size++;
+    }
+    for (int i = 0; i < s->block_size; i++) {
+        s->blocks[i].pred = pred;
+        pred += s->blocks[i].pred_size;
+        s->blocks[i].pred_size = 0;
+    }
+    for (int i = 0; i < s->block_size; i++) {
+        for (int j = 0; s->blocks[i].reach && j < s->blocks[i].succ_size; j++) {
+            struct ssa_block* t = &s->blocks[s->blocks[i].succ[j]];
+            s->preds[t->pred + t->pred_size++] = i;
+        }
+    }
+    return s->blocks[0].pred_size == 0;
+}
+
+// Finds the operand stack depth at each block entry. Statements may leave
+// unused values behind, so paths can meet with different depths; such a
+// block keeps the lowest depth and the values below it become poison, which
+// nothing after the merge may consume. A return with only poison below it
+// gives back whatever lies on top, as it always did.
+bool ssa_depths(struct ssa* s, struct node* nodes, struct label* labels) {
+    for (int i = 0; i < s->block_size; i++) {
+        struct ssa_block* bl = &s->blocks[i];
+        int depth = 0;
+        for (int j = bl->start; bl->reach && j < bl->end; j++) {
+            struct node* n = &nodes[j];
+            if (ssa_skip(n->op) || n->op == OP_RETURN)
+                continue;
+            if (n->op == OP_TAILCALL || n->op == OP_LABEL_FNEND || (n->op == OP_CALL && n->val == -1))
+                return false;
+            if (depth - node_pops(n, labels) < bl->low)
+                bl->low = depth - node_pops(n, labels);
+            depth += node_effect(n, labels);
+        }
+        bl->net = depth;
+    }
+    s->blocks[0].depth = 0;
+    for (bool changed = true; changed;) {
+        changed = false;
+        for (int i = 0; i < s->order_size; i++) {
+            struct ssa_block* bl = &s->blocks[s->order[i]];
+            int out = bl->depth + bl->net;
+            if (bl->depth == -1)
+                continue;
+            if (bl->depth + bl->low < 0 || out > SSA_DEPTH)
+                return false;
+            for (int j = 0; j < bl->succ_size; j++) {
+                struct ssa_block* t = &s->blocks[bl->succ[j]];
+                if (t->depth == -1 || out < t->depth) {
+                    t->depth = out;
+                    changed = true;
+                }
+            }
+        }
+    }
+    for (int i = 0; i < s->order_size; i++) {
+        struct ssa_block* bl = &s->blocks[s->order[i]];
+        for (int j = 0; j < bl->pred_size; j++) {
+            struct ssa_block* p = &s->blocks[s->preds[bl->pred + j]];
+            bl->ragged = bl->ragged || p->depth + p->net != bl->depth;
+        }
+        bl->poison = bl->ragged ? bl->depth : 0;
+    }
+    for (bool changed = true; changed;) {
+        changed = false;
+        for (int i = 0; i < s->order_size; i++) {
+            struct ssa_block* bl = &s->blocks[s->order[i]];
+            for (int j = 0; !bl->ragged && j < bl->pred_size; j++) {
+                int poison = s->blocks[s->preds[bl->pred + j]].poison;
+                if (poison > bl->depth)
+                    poison = bl->depth;
+                if (poison > bl->poison) {
+                    bl->poison = poison;
+                    changed = true;
+                }
+            }
+        }
+    }
+    for (int i = 0; i < s->order_size; i++) {
+        struct ssa_block* bl = &s->blocks[s->order[i]];
+        if (bl->depth + bl->low < bl->poison)
+            return false;
+    }
+    return true;
+}
+
+// A local lives in an SSA value instead of its frame slot when the function
+// never uses a frame address as a value and never reaches its frame through
+// IP/SP/BP, so its slot can only be read and written by name. A local whose
+// address is left on the stack across a block boundary stays in memory.
+void ssa_promote(struct ssa* s, struct node* nodes, struct label* labels) {
+    int tags[SSA_DEPTH];
+    bool all = true;
+    for (int i = 0; i < 2 * STK_SZ; i++)
+        s->promote[i] = i < STK_SZ - 3 || i >= STK_SZ;
+    for (int i = 0; i < s->order_size; i++) {
+        struct ssa_block* bl = &s->blocks[s->order[i]];
+        int depth = bl->depth;
+        for (int j = 0; j < depth; j++)
+            tags[j] = -1;
+        for (int j = bl->start; j < bl->end; j++) {
+            struct node* n = &nodes[j];
+            if (ssa_skip(n->op))
+                continue;
+            int pops = n->op == OP_RETURN ? depth > bl->poison : node_pops(n, labels);
+            int pushes = n->op == OP_RETURN ? 0 : pops + node_effect(n, labels);
+            depth -= pops;
+            for (int k = 0; k < pops; k++) {
+                bool direct = (n->op == OP_GLOBAL_GET || n->op == OP_GLOBAL_SET) && k == 0;
+                if ((tags[depth + k] >= 0 && !direct) || (tags[depth + k] == -2 && direct))
+                    all = false;
+            }
+            if (pushes == 0)
+                continue;
+            tags[depth] = -1;
+            if (n->op == OP_PUSH_VARADDR && n->val + STK_SZ >= 0 && n->val < STK_SZ)
+                tags[depth] = n->val + STK_SZ;
+            else if (n->op == OP_PUSH_VARADDR)
+                all = false;
+            else if (n->op == OP_PUSH_CONST && is_frame_reg(n->val))
+                tags[depth] = -2;
+            depth++;
+        }
+        for (int j = bl->poison; j < depth; j++) {
+            if (tags[j] >= 0)
+                s->promote[tags[j]] = false;
+        }
+    }
+    for (int i = 0; all == false && i < 2 * STK_SZ; i++)
+        s->promote[i] = false;
+}
+
+int ssa_local(struct ssa* s, int v) {
+    if (v <= 0)
+        return -1;
+    struct ssa_val* x = &s->vals[v];
+    if (x->kind != SSA_NODE || x->op != OP_PUSH_VARADDR || x->val + STK_SZ < 0 || x->val >= STK_SZ)
+        return -1;
+    return s->promote[x->val + STK_SZ] ? x->val + STK_SZ : -1;
+}
+
+// A local read before any store takes the value its slot holds on entry:
+// the argument for parameters, stale memory for the rest, as before.
+int ssa_undef(struct ssa* s, int var) {
+    if (var >= SSA_STACK) {
+        s->fail = true;
+        return 0;
+    }
+    int addr = ssa_new(s, SSA_NODE, OP_PUSH_VARADDR, NULL, var - STK_SZ, 0, 0);
+    int v = ssa_new(s, SSA_NODE, OP_GLOBAL_GET, NULL, 0, 0, 1);
+    if (s->fail)
+        return 0;
+    s->args[s->vals[v].arg] = addr;
+    s->vals[v].var = var;
+    s->vals[addr].next = v;
+    if (s->entry_tail == -1)
+        s->entry_head = addr;
+    else
+        s->vals[s->entry_tail].next = addr;
+    s->entry_tail = v;
+    return v;
+}
+
+int ssa_phi(struct ssa* s, int var, int b) {
+    int v = ssa_new(s, SSA_PHI, OP_NULL, NULL, 0, b, 0);
+    if (s->fail)
+        return 0;
+    s->vals[v].var = var;
+    s->vals[v].next = s->blocks[b].phis;
+    s->blocks[b].phis = v;
+    return v;
+}
+
+// A phi whose operands are all one value, or itself, is that value.
+int ssa_trivial(struct ssa* s, int phi) {
+    struct ssa_val* p = &s->vals[phi];
+    int same = -1;
+    if (p->repl != -1)
+        return ssa_find(s, phi);
+    for (int i = 0; i < p->arg_size; i++) {
+        int v = ssa_base(s, s->args[p->arg + i]);
+        if (v == same || v == phi)
+            continue;
+        if (same != -1)
+            return phi;
+        same = v;
+    }
+    if (same == -1) {
+        s->fail = true;
+        return phi;
+    }
+    p->repl = same;
+    return same;
+}
+
+int ssa_phi_ops(struct ssa* s, int var, int phi) {
+    struct ssa_block* bl = &s->blocks[s->vals[phi].block];
+    int arg = ssa_args(s, bl->pred_size);
+    if (s->fail)
+        return phi;
+    s->vals[phi].arg = arg;
+    s->vals[phi].arg_size = bl->pred_size;
+    for (int i = 0; i < bl->pred_size; i++)
+        s->args[arg + i] = ssa_read(s, var, s->preds[bl->pred + i]);
+    return ssa_trivial(s, phi);
+}
+
+// Looks up a variable the way Braun et al. build SSA on the fly: the last
+// store in the block, else the single predecessor's value, else a phi. A
+// block whose predecessors are not all filled yet gets an incomplete phi that
+// is finished when the block is sealed.
+int ssa_read(struct ssa* s, int var, int b) {
+    struct ssa_def* d = ssa_def(s, var, b, false);
+    struct ssa_block* bl = &s->blocks[b];
+    int v;
+    if (d != NULL)
+        return ssa_find(s, d->val);
+    if (!bl->sealed) {
+        v = ssa_phi(s, var, b);
+        s->vals[v].inc = bl->incomplete;
+        bl->incomplete = v;
+    } else if (bl->pred_size == 0) {
+        v = ssa_undef(s, var);
+    } else if (bl->pred_size == 1) {
+        v = ssa_read(s, var, s->preds[bl->pred]);
+    } else {
+        v = ssa_phi(s, var, b);
+        ssa_def(s, var, b, true)->val = v;
+        v = ssa_phi_ops(s, var, v);
+    }
+    ssa_def(s, var, b, true)->val = v;
+    return v;
+}
+
+void ssa_seal(struct ssa* s, int b) {
+    struct ssa_block* bl = &s->blocks[b];
+    if (bl->sealed)
+        return;
+    for (int i = 0; i < bl->pred_size; i++) {
+        if (!s->blocks[s->preds[bl->pred + i]].filled)
+            return;
+    }
+    bl->sealed = true;
+    for (int v = bl->incomplete; v != -1 && !s->fail; v = s->vals[v].inc)
+        ssa_phi_ops(s, s->vals[v].var, v);
+}
+
+int ssa_push_read(struct ssa* s, int b, struct token* token, int v) {
+    int r = ssa_new(s, SSA_READ, OP_NULL, token, 0, b, 1);
+    s->args[s->vals[r].arg] = v;
+    ssa_append(s, b, r);
+    return r;
+}
+
+// Translates one block. Operand stack slots are variables too, so values
+// passed between blocks on the stack get phis like locals do.
+void ssa_fill(struct ssa* s, struct node* nodes, struct label* labels, int b) {
+    struct ssa_block* bl = &s->blocks[b];
+    int depth = bl->depth;
+    int x;
+    for (int d = 0; d < depth; d++)
+        s->stack[d] = d < bl->poison ? -1 : ssa_push_read(s, b, NULL, ssa_read(s, SSA_STACK + d, b));
+    for (int i = bl->start; i < bl->end && !s->fail; i++) {
+        struct node* n = &nodes[i];
+        if (ssa_skip(n->op))
+            continue;
+        if (n->op == OP_GLOBAL_GET && (x = ssa_local(s, s->stack[depth - 1])) != -1) {
+            s->stack[depth - 1] = ssa_push_read(s, b, n->token, ssa_read(s, x, b));
+        } else if (n->op == OP_GLOBAL_SET && (x = ssa_local(s, s->stack[depth - 2])) != -1) {
+            ssa_def(s, x, b, true)->val = s->stack[depth - 1];
+            depth -= 2;
+        } else if (n->op == OP_RETURN && depth <= bl->poison) {
+            ssa_append(s, b, ssa_new(s, SSA_NODE, OP_RETURN, n->token, 0, b, 0));
+        } else {
+            int pops = n->op == OP_RETURN ? 1 : node_pops(n, labels);
+            int pushes = n->op == OP_RETURN ? 0 : pops + node_effect(n, labels);
+            int v = ssa_new(s, SSA_NODE, n->op, n->token, n->val, b, pops);
+            depth -= pops;
+            for (int k = 0; k < pops; k++) {
+                if (s->stack[depth + k] == -1)
+                    s->fail = true;
+                s->args[s->vals[v].arg + k] = s->stack[depth + k];
+            }
+            ssa_append(s, b, v);
+            if (pushes == 1)
+                s->stack[depth++] = v;
+        }
+    }
+    for (int d = bl->poison; d < depth && !s->fail; d++)
+        ssa_def(s, SSA_STACK + d, b, true)->val = s->stack[d];
+}
+
+// Builds the IR for the reachable blocks in order, then drops the phis that
+// turned out trivial and lets reads and phis refer to values, not to reads.
+void ssa_build(struct ssa* s, struct node* nodes, struct label* labels) {
+    for (int i = 0; i < s->block_size && !s->fail; i++) {
+        struct ssa_block* bl = &s->blocks[i];
+        if (!bl->reach)
+            continue;
+        ssa_seal(s, i);
+        ssa_fill(s, nodes, labels, i);
+        bl->filled = true;
+        for (int j = 0; j < bl->succ_size; j++)
+            ssa_seal(s, bl->succ[j]);
+    }
+    for (int i = 0; i < s->order_size; i++)
+        s->fail = s->fail || !s->blocks[s->order[i]].sealed;
+    if (s->fail)
+        return;
+    if (s->entry_head != -1) {
+        s->vals[s->entry_tail].next = s->blocks[0].head;
+        s->blocks[0].head = s->entry_head;
+        if (s->blocks[0].tail == -1)
+            s->blocks[0].tail = s->entry_tail;
+    }
+    for (bool changed = true; changed && !s->fail;) {
+        changed = false;
+        for (int i = 0; i < s->order_size; i++) {
+            for (int p = s->blocks[s->order[i]].phis; p != -1; p = s->vals[p].next)
+                changed = (s->vals[p].repl == -1 && ssa_trivial(s, p) != p) || changed;
+        }
+    }
+    for (int v = 1; v < s->val_size; v++) {
+        struct ssa_val* x = &s->vals[v];
+        for (int k = 0; k < x->arg_size; k++) {
+            int* a = &s->args[x->arg + k];
+            *a = x->kind == SSA_NODE ? ssa_find(s, *a) : ssa_base(s, *a);
+        }
+    }
+}
+
+int ssa_intersect(struct ssa* s, int a, int b) {
+    while (a != b) {
+        while (s->blocks[a].rpo > s->blocks[b].rpo)
+            a = s->blocks[a].idom;
+        while (s->blocks[b].rpo > s->blocks[a].rpo)
+            b = s->blocks[b].idom;
+    }
+    return a;
+}
+
+// Immediate dominators by the iterative scheme of Cooper, Harvey and
+// Kennedy, then the dominator tree as child and sibling links.
+void ssa_dominators(struct ssa* s) {
+    s->blocks[0].idom = 0;
+    for (bool changed = true; changed;) {
+        changed = false;
+        for (int i = 1; i < s->order_size; i++) {
+            struct ssa_block* bl = &s->blocks[s->order[i]];
+            int idom = -1;
+            for (int j = 0; j < bl->pred_size; j++) {
+                int p = s->preds[bl->pred + j];
+                if (s->blocks[p].idom != -1)
+                    idom = idom == -1 ? p : ssa_intersect(s, p, idom);
+            }
+            if (idom != bl->idom) {
+                bl->idom = idom;
+                changed = true;
+            }
+        }
+    }
+    for (int i = s->order_size - 1; i > 0; i--) {
+        struct ssa_block* bl = &s->blocks[s->order[i]];
+        bl->sibling = s->blocks[bl->idom].child;
+        s->blocks[bl->idom].child = s->order[i];
+    }
+}
+
+bool ssa_fold(enum op op, int a, int b, int* r) {
+    switch (op) {
+        case OP_OR:
+            *r = a | b;
+            return true;
+        case OP_AND:
+            *r = a & b;
+            return true;
+        case OP_EQ:
+            *r = a == b;
+            return true;
+        case OP_NE:
+            *r = a != b;
+            return true;
+        case OP_LT:
+            *r = a < b;
+            return true;
+        case OP_GT:
+            *r = a > b;
+            return true;
+        case OP_ADD:
+            *r = (int)((unsigned)a + (unsigned)b);
+            return true;
+        case OP_SUB:
+            *r = (int)((unsigned)a - (unsigned)b);
+            return true;
+        case OP_MUL:
+            *r = (int)((unsigned)a * (unsigned)b);
+            return true;
+        case OP_DIV:
+            if (b == 0 || b == -1)
+                return false;
+            *r = a / b;
+            return true;
+        case OP_MOD:
+            if (b == 0 || b == -1)
+                return false;
+            *r = a % b;
+            return true;
+        default:
+            return false;
+    }
+}
+
+bool ssa_commutes(enum op op) {
+    return op == OP_OR || op == OP_AND || op == OP_EQ || op == OP_NE || op == OP_ADD || op == OP_MUL;
+}
+
+// Constants and frame addresses are numbered by what they push, anything
+// else by the value itself.
+long ssa_key(struct ssa* s, int v) {
+    struct ssa_val* x = &s->vals[ssa_base(s, v)];
+    if (x->kind == SSA_NODE && x->op == OP_PUSH_CONST)
+        return (long)x->val * 4 + 1;
+    if (x->kind == SSA_NODE && x->op == OP_PUSH_VARADDR)
+        return (long)x->val * 4 + 2;
+    return (long)(x - s->vals) * 4;
+}
+
+void ssa_keys(struct ssa* s, int v, long* k) {
+    struct ssa_val* x = &s->vals[v];
+    k[0] = ssa_key(s, s->args[x->arg]);
+    k[1] = ssa_key(s, s->args[x->arg + 1]);
+    if (ssa_commutes(x->op) && k[0] > k[1]) {
+        long t = k[0];
+        k[0] = k[1];
+        k[1] = t;
+    }
+}
+
+// Global value numbering over the dominator tree: an arithmetic value equal
+// to one computed in a dominating position is replaced by it. Operations on
+// constants are folded first. Reusing a value costs a slot store and a load,
+// so only expressions of at least GVN_MIN nodes are shared.
+void ssa_gvn(struct ssa* s, int b) {
+    int mark = s->gvn_size;
+    for (int v = s->blocks[b].head; v != -1; v = s->vals[v].next) {
+        struct ssa_val* x = &s->vals[v];
+        long k[2];
+        long e[2];
+        int c;
+        x->cost = 1;
+        for (int i = 0; i < x->arg_size; i++) {
+            struct ssa_val* a = &s->vals[ssa_find(s, s->args[x->arg + i])];
+            x->cost += a->kind == SSA_NODE ? a->cost : 2;
+        }
+        if (x->cost > SSA_DEPTH)
+            x->cost = SSA_DEPTH;
+        if (x->kind != SSA_NODE || x->op < OP_OR || x->op > OP_MOD)
+            continue;
+        struct ssa_val* l = &s->vals[ssa_base(s, s->args[x->arg])];
+        struct ssa_val* r = &s->vals[ssa_base(s, s->args[x->arg + 1])];
+        if (l->kind == SSA_NODE && l->op == OP_PUSH_CONST && r->kind == SSA_NODE && r->op == OP_PUSH_CONST && ssa_fold(x->op, l->val, r->val, &c)) {
+            x->op = OP_PUSH_CONST;
+            x->val = c;
+            x->arg_size = 0;
+            x->cost = 1;
+            s->merged++;
+            continue;
+        }
+        if (x->cost < GVN_MIN)
+            continue;
+        ssa_keys(s, v, k);
+        unsigned h = ((unsigned)x->op * 31u + (unsigned)k[0] * 2654435761u + (unsigned)k[1] * 40503u) & (SSA_DEFS - 1);
+        for (; s->gvn[h] != 0; h = (h + 1) & (SSA_DEFS - 1)) {
+            ssa_keys(s, s->gvn[h] - 1, e);
+            if (s->vals[s->gvn[h] - 1].op == x->op && e[0] == k[0] && e[1] == k[1])
+                break;
+        }
+        if (s->gvn[h] != 0) {
+            x->repl = s->gvn[h] - 1;
+            s->merged++;
+        } else if (s->gvn_size < SSA_DEFS / 2) {
+            s->gvn[h] = v + 1;
+            s->gvn_log[s->gvn_size++] = h;
+        }
+    }
+    for (int c = s->blocks[b].child; c != -1; c = s->blocks[c].sibling)
+        ssa_gvn(s, c);
+    while (s->gvn_size > mark)
+        s->gvn[s->gvn_log[--s->gvn_size]] = 0;
+}
+
+// Keeps what stores, calls, services, vector updates and control flow need,
+// transitively. Stores to promoted locals never became nodes, so this also
+// drops the values only they used.
+void ssa_dce(struct ssa* s) {
+    int size = 0;
+    for (int i = 0; i < s->order_size; i++) {
+        for (int v = s->blocks[s->order[i]].head; v != -1; v = s->vals[v].next) {
+            if (s->vals[v].repl == -1 && ssa_root(&s->vals[v])) {
+                s->vals[v].live = true;
+                s->active[size++] = v;
+            }
+        }
+    }
+    while (size != 0) {
+        struct ssa_val* x = &s->vals[s->active[--size]];
+        for (int k = 0; k < x->arg_size; k++) {
+            int a = ssa_find(s, s->args[x->arg + k]);
+            if (!s->vals[a].live) {
+                s->vals[a].live = true;
+                s->active[size++] = a;
+            }
+        }
+    }
+    for (int i = 0; i < s->order_size; i++) {
+        for (int v = s->blocks[s->order[i]].head; v != -1; v = s->vals[v].next) {
+            struct ssa_val* x = &s->vals[v];
+            if (!x->live && x->repl == -1 && x->kind == SSA_NODE && ssa_local(s, v) == -1)
+                s->removed++;
+        }
+    }
+}
+
+void ssa_uses(struct ssa* s) {
+    for (int v = 1; v < s->val_size; v++) {
+        s->vals[v].uses = 0;
+        s->vals[v].user = -1;
+    }
+    for (int v = 1; v < s->val_size; v++) {
+        struct ssa_val* x = &s->vals[v];
+        for (int k = 0; x->live && x->repl == -1 && k < x->arg_size; k++) {
+            struct ssa_val* a = &s->vals[ssa_find(s, s->args[x->arg + k])];
+            a->uses++;
+            a->user = v;
+        }
+    }
+}
+
+bool ssa_emitted(struct ssa_val* x) {
+    return x->live && x->repl == -1 && x->kind != SSA_PHI && !ssa_entry(x) && (x->stacked || !ssa_remat(x));
+}
+
+// A result nothing reads, such as that of a call kept for its effects, still
+// gets a slot so its store takes it off the stack.
+bool ssa_slotted(struct ssa* s, int v) {
+    struct ssa_val* x = &s->vals[v];
+    if (!x->live || x->repl != -1)
+        return false;
+    if (x->uses == 0)
+        return x->kind == SSA_NODE && ssa_result(x) && !ssa_remat(x) && !ssa_entry(x);
+    return x->kind == SSA_PHI || (ssa_result(x) && !x->stacked && !ssa_remat(x));
+}
+
+void ssa_unstack(struct ssa* s, int v, bool* changed) {
+    if (s->vals[v].stacked) {
+        s->vals[v].stacked = false;
+        *changed = true;
+    }
+}
+
+// Decides which values stay on the operand stack from producer to consumer.
+// A value used once, later in its own block, stays there when the consumer
+// finds it right below its other stacked operands; since the IR keeps the
+// original order, that is nearly always so. The rest go to frame slots, or
+// are pushed again where used when they are constants, frame addresses or
+// reads.
+void ssa_stackify(struct ssa* s) {
+    int* top = s->stack;
+    for (int v = 1; v < s->val_size; v++) {
+        struct ssa_val* x = &s->vals[v];
+        struct ssa_val* u = x->user == -1 ? x : &s->vals[x->user];
+        x->stacked = x->live && x->repl == -1 && x->uses == 1 && ssa_result(x) && !ssa_entry(x) && u->kind != SSA_PHI && u->block == x->block;
+    }
+    for (bool changed = true; changed && !s->fail;) {
+        changed = false;
+        for (int i = 0; i < s->block_size; i++) {
+            int size = 0;
+            for (int v = s->blocks[i].reach ? s->blocks[i].head : -1; v != -1; v = s->vals[v].next) {
+                struct ssa_val* x = &s->vals[v];
+                if (!x->live || x->repl != -1 || ssa_entry(x))
+                    continue;
+                if (ssa_remat(x) && !x->stacked) {
+                    if (x->kind == SSA_READ)
+                        ssa_unstack(s, ssa_find(s, s->args[x->arg]), &changed);
+                    continue;
+                }
+                int m = x->arg_size < size ? x->arg_size : size;
+                for (; m > 0; m--) {
+                    int k = 0;
+                    for (; k < m; k++) {
+                        int a = ssa_find(s, s->args[x->arg + k]);
+                        if (top[size - m + k] != a || !s->vals[a].stacked)
+                            break;
+                    }
+                    if (k == m)
+                        break;
+                }
+                for (int k = m; k < x->arg_size; k++)
+                    ssa_unstack(s, ssa_find(s, s->args[x->arg + k]), &changed);
+                size -= m;
+                x->stack_args = m;
+                if (!ssa_result(x) || !x->stacked)
+                    continue;
+                if (size == SSA_DEPTH) {
+                    s->fail = true;
+                    return;
+                }
+                top[size++] = v;
+            }
+            for (int k = 0; k < size; k++)
+                ssa_unstack(s, top[k], &changed);
+        }
+    }
+}
+
+// Numbers the emitted values in output order. Each gets two positions: its
+// operands are read at the first and its result written at the second. A
+// block's entry and exit get a pair too, for phis and the copies into them.
+void ssa_positions(struct ssa* s) {
+    int pos = 0;
+    for (int i = 0; i < s->block_size; i++) {
+        struct ssa_block* bl = &s->blocks[i];
+        if (!bl->reach)
+            continue;
+        bl->pos_start = pos;
+        pos += 2;
+        for (int v = bl->head; v != -1; v = s->vals[v].next) {
+            struct ssa_val* x = &s->vals[v];
+            if (!ssa_emitted(x))
+                continue;
+            x->pos = pos;
+            pos += 2;
+            x->first = x->stack_args > 0 ? s->vals[ssa_find(s, s->args[x->arg])].first : v;
+            if (ssa_slotted(s, v))
+                s->vals[x->first].addr_for = v;
+        }
+        bl->pos_end = pos;
+        pos += 2;
+    }
+}
+
+enum live_set {
+    LIVE_IN,
+    LIVE_OUT,
+    LIVE_GEN,
+    LIVE_KILL,
+    LIVE_SETS,
+};
+
+unsigned long* ssa_set(struct ssa* s, int b, enum live_set set) {
+    return &s->live[((long)b * LIVE_SETS + set) * s->words];
+}
+
+bool ssa_bit(unsigned long* set, int i) {
+    return set[i / 64] >> (i % 64) & 1;
+}
+
+void ssa_mark(unsigned long* set, int i) {
+    set[i / 64] |= 1ul << (i % 64);
+}
+
+int ssa_pred_index(struct ssa* s, int b, int p) {
+    struct ssa_block* bl = &s->blocks[b];
+    int k = 0;
+    while (k < bl->pred_size - 1 && s->preds[bl->pred + k] != p)
+        k++;
+    return k;
+}
+
+// Adds to set the values b passes to the phis of its successors.
+void ssa_phi_uses(struct ssa* s, int b, unsigned long* set) {
+    struct ssa_block* bl = &s->blocks[b];
+    for (int j = 0; j < bl->succ_size; j++) {
+        int k = ssa_pred_index(s, bl->succ[j], b);
+        for (int p = s->blocks[bl->succ[j]].phis; p != -1; p = s->vals[p].next) {
+            int v = ssa_find(s, s->args[s->vals[p].arg + k]);
+            if (ssa_slotted(s, p) && ssa_slotted(s, v))
+                ssa_mark(set, s->vals[v].dense);
+        }
+    }
+}
+
+// Live sets of the values kept in slots, per block, as bit sets. A phi is
+// live into its block, and its operands are live out of the matching
+// predecessor.
+bool ssa_liveness(struct ssa* s) {
+    s->dense_size = 0;
+    for (int v = 1; v < s->val_size; v++) {
+        if (!ssa_slotted(s, v))
+            continue;
+        s->vals[v].dense = s->dense_size;
+        s->vals[v].start = 1 << 30;
+        s->vals[v].end = -1;
+        s->dense[s->dense_size++] = v;
+    }
+    s->words = s->dense_size / 64 + 1;
+    if (((long)s->block_size * LIVE_SETS + 2) * s->words > SSA_LIVE)
+        return false;
+    unsigned long* out = ssa_set(s, s->block_size, LIVE_IN);
+    unsigned long* in = out + s->words;
+    for (long i = 0; i < ((long)s->block_size * LIVE_SETS + 2) * s->words; i++)
+        s->live[i] = 0;
+    for (int i = 0; i < s->order_size; i++) {
+        int b = s->order[i];
+        unsigned long* gen = ssa_set(s, b, LIVE_GEN);
+        unsigned long* kill = ssa_set(s, b, LIVE_KILL);
+        for (int p = s->blocks[b].phis; p != -1; p = s->vals[p].next) {
+            if (ssa_slotted(s, p))
+                ssa_mark(kill, s->vals[p].dense);
+        }
+        for (int v = s->blocks[b].head; v != -1; v = s->vals[v].next) {
+            struct ssa_val* x = &s->vals[v];
+            if (!ssa_emitted(x))
+                continue;
+            if (ssa_slotted(s, v))
+                ssa_mark(kill, x->dense);
+            for (int k = x->stack_args; k < x->arg_size; k++) {
+                int a = ssa_find(s, s->args[x->arg + k]);
+                if (ssa_slotted(s, a) && s->vals[a].block != b)
+                    ssa_mark(gen, s->vals[a].dense);
+            }
+        }
+    }
+    for (bool changed = true; changed;) {
+        changed = false;
+        for (int i = s->order_size - 1; i >= 0; i--) {
+            int b = s->order[i];
+            struct ssa_block* bl = &s->blocks[b];
+            for (int w = 0; w < s->words; w++)
+                out[w] = 0;
+            for (int j = 0; j < bl->succ_size; j++) {
+                unsigned long* live = ssa_set(s, bl->succ[j], LIVE_IN);
+                for (int w = 0; w < s->words; w++)
+                    in[w] = live[w];
+                for (int p = s->blocks[bl->succ[j]].phis; p != -1; p = s->vals[p].next) {
+                    if (ssa_slotted(s, p))
+                        in[s->vals[p].dense / 64] &= ~(1ul << (s->vals[p].dense % 64));
+                }
+                for (int w = 0; w < s->words; w++)
+                    out[w] |= in[w];
+            }
+            ssa_phi_uses(s, b, out);
+            unsigned long* gen = ssa_set(s, b, LIVE_GEN);
+            unsigned long* kill = ssa_set(s, b, LIVE_KILL);
+            for (int w = 0; w < s->words; w++) {
+                in[w] = gen[w] | (out[w] & ~kill[w]);
+            }
+            for (int p = bl->phis; p != -1; p = s->vals[p].next) {
+                if (ssa_slotted(s, p))
+                    ssa_mark(in, s->vals[p].dense);
+            }
+            unsigned long* live_out = ssa_set(s, b, LIVE_OUT);
+            unsigned long* live_in = ssa_set(s, b, LIVE_IN);
+            for (int w = 0; w < s->words; w++) {
+                changed = changed || live_out[w] != out[w] || live_in[w] != in[w];
+                live_out[w] = out[w];
+                live_in[w] = in[w];
+            }
+        }
+    }
+    return true;
+}
+
+void ssa_touch(struct ssa_val* x, int pos) {
+    if (pos < x->start)
+        x->start = pos;
+    if (pos > x->end)
+        x->end = pos;
+}
+
+// Turns the live sets into one interval of positions per value.
+void ssa_intervals(struct ssa* s) {
+    for (int b = 0; b < s->block_size; b++) {
+        struct ssa_block* bl = &s->blocks[b];
+        if (!bl->reach)
+            continue;
+        unsigned long* in = ssa_set(s, b, LIVE_IN);
+        unsigned long* out = ssa_set(s, b, LIVE_OUT);
+        for (int w = 0; w < s->words; w++) {
+            for (int i = 0; (in[w] | out[w]) != 0 && i < 64; i++) {
+                if (in[w] >> i & 1)
+                    ssa_touch(&s->vals[s->dense[w * 64 + i]], bl->pos_start + 1);
+                if (out[w] >> i & 1)
+                    ssa_touch(&s->vals[s->dense[w * 64 + i]], bl->pos_end + 1);
+            }
+        }
+        for (int v = bl->head; v != -1; v = s->vals[v].next) {
+            struct ssa_val* x = &s->vals[v];
+            if (!ssa_emitted(x))
+                continue;
+            if (ssa_slotted(s, v))
+                ssa_touch(x, x->pos + 1);
+            for (int k = x->stack_args; k < x->arg_size; k++) {
+                int a = ssa_find(s, s->args[x->arg + k]);
+                if (ssa_slotted(s, a))
+                    ssa_touch(&s->vals[a], x->pos);
+            }
+        }
+    }
+}
+
+// Whether x is read in block b after position pos.
+bool ssa_used_after(struct ssa* s, int b, int pos, int x) {
+    for (int u = s->blocks[b].head; u != -1; u = s->vals[u].next) {
+        struct ssa_val* y = &s->vals[u];
+        for (int k = y->stack_args; ssa_emitted(y) && y->pos > pos && k < y->arg_size; k++) {
+            if (ssa_find(s, s->args[y->arg + k]) == x)
+                return true;
+        }
+    }
+    return false;
+}
+
+// Whether x is live on the edge from b to t for anything but the copy into
+// phi p.
+bool ssa_live_edge(struct ssa* s, int b, int t, int x, int p) {
+    int k = ssa_pred_index(s, t, b);
+    bool def = s->vals[x].kind == SSA_PHI && s->vals[x].block == t;
+    if (!def && ssa_bit(ssa_set(s, t, LIVE_IN), s->vals[x].dense))
+        return true;
+    for (int q = s->blocks[t].phis; q != -1; q = s->vals[q].next) {
+        if (q != p && ssa_slotted(s, q) && ssa_find(s, s->args[s->vals[q].arg + k]) == x)
+            return true;
+    }
+    return false;
+}
+
+// Whether x is live at the end of block b for anything but the copy into
+// phi p.
+bool ssa_live_out(struct ssa* s, int b, int x, int p) {
+    struct ssa_block* bl = &s->blocks[b];
+    for (int j = 0; j < bl->succ_size; j++) {
+        if (ssa_live_edge(s, b, bl->succ[j], x, p))
+            return true;
+    }
+    return false;
+}
+
+// Whether the copies from b into the phis of t come after b's branch, on the
+// fallthrough edge alone.
+bool ssa_after_branch(struct ssa* s, int b, int t) {
+    struct ssa_block* bl = &s->blocks[b];
+    return bl->succ_size == 2 && bl->succ[0] != bl->succ[1] && bl->succ[1] == t;
+}
+
+// Whether x is live where v is written: right after its definition, or for
+// a phi at the end of each predecessor, where the copies go.
+bool ssa_live_at(struct ssa* s, int x, int v) {
+    struct ssa_val* y = &s->vals[v];
+    struct ssa_val* z = &s->vals[x];
+    struct ssa_block* bl = &s->blocks[y->block];
+    if (x == v || ssa_entry(y))
+        return false;
+    if (y->kind == SSA_PHI) {
+        for (int k = 0; k < bl->pred_size; k++) {
+            int pred = s->preds[bl->pred + k];
+            if (ssa_after_branch(s, pred, y->block) ? ssa_live_edge(s, pred, y->block, x, v) : ssa_live_out(s, pred, x, v))
+                return true;
+        }
+        return false;
+    }
+    if (ssa_emitted(z) && z->block == y->block && z->pos > y->pos)
+        return false;
+    return ssa_live_out(s, y->block, x, -1) || ssa_used_after(s, y->block, y->pos, x);
+}
+
+void ssa_assign(struct ssa* s, int v, int slot) {
+    s->vals[v].slot = slot;
+    s->vals[v].slot_next = s->slot_head[slot + STK_SZ];
+    s->slot_head[slot + STK_SZ] = v;
+}
+
+// Whether v can share a slot with everything already in it.
+bool ssa_fits(struct ssa* s, int slot, int v) {
+    for (int u = s->slot_head[slot + STK_SZ]; u != -1; u = s->vals[u].slot_next) {
+        if (ssa_live_at(s, u, v) || ssa_live_at(s, v, u))
+            return false;
+    }
+    return true;
+}
+
+// Assigns frame slots. Entry values stay in their locals' slots, and a phi
+// joins the slot of its local when nothing there overlaps it, so a loop
+// variable keeps living where it always did. A value computed only to
+// become a phi operand is stored straight into the phi's slot when the phi
+// is dead by then. Other phis get slots of their own above the function's
+// locals, and the remaining values share slots by linear scan.
+bool ssa_slots(struct ssa* s, int base) {
+    int next = base;
+    int active = 0;
+    int free = 0;
+    for (int i = 0; i < 2 * STK_SZ; i++)
+        s->slot_head[i] = -1;
+    for (int v = 1; v < s->val_size; v++) {
+        if (ssa_entry(&s->vals[v]) && ssa_slotted(s, v))
+            ssa_assign(s, v, s->vals[v].var - STK_SZ);
+    }
+    for (int b = 0; b < s->block_size; b++) {
+        for (int p = s->blocks[b].reach ? s->blocks[b].phis : -1; p != -1; p = s->vals[p].next) {
+            int var = s->vals[p].var;
+            if (!ssa_slotted(s, p))
+                continue;
+            if (var < SSA_STACK && ssa_fits(s, var - STK_SZ, p))
+                ssa_assign(s, p, var - STK_SZ);
+            else if (next < TMP_FRAME)
+                ssa_assign(s, p, next++);
+            else
+                return false;
+        }
+    }
+    for (int b = 0; b < s->block_size; b++) {
+        struct ssa_block* bl = &s->blocks[b];
+        for (int p = bl->reach ? bl->phis : -1; p != -1; p = s->vals[p].next) {
+            for (int k = 0; ssa_slotted(s, p) && k < bl->pred_size; k++) {
+                int v = ssa_find(s, s->args[s->vals[p].arg + k]);
+                struct ssa_val* x = &s->vals[v];
+                if (x->kind == SSA_NODE && ssa_slotted(s, v) && x->slot == -1 && ssa_fits(s, s->vals[p].slot, v))
+                    ssa_assign(s, v, s->vals[p].slot);
+            }
+        }
+    }
+    for (int b = 0; b < s->block_size; b++) {
+        for (int v = s->blocks[b].reach ? s->blocks[b].head : -1; v != -1; v = s->vals[v].next) {
+            struct ssa_val* x = &s->vals[v];
+            if (!ssa_emitted(x) || !ssa_slotted(s, v) || x->slot != -1)
+                continue;
+            if (x->start != x->pos + 1 || next >= TMP_FRAME)
+                return false;
+            for (int i = 0; i < active;) {
+                struct ssa_val* a = &s->vals[s->active[i]];
+                if (a->end < x->start) {
+                    s->free_slots[free++] = a->slot;
+                    s->active[i] = s->active[--active];
+                } else {
+                    i++;
+                }
+            }
+            x->slot = free > 0 ? s->free_slots[--free] : next++;
+            s->active[active++] = v;
+        }
+    }
+    s->scratch = next++;
+    return next <= TMP_FRAME;
+}
+
+void ssa_push(struct ssa* s, enum op op, struct token* token, int val) {
+    if (s->out_size + 1 >= (int)(COMP_SZ / sizeof(struct node))) {
+        s->full = true;
+        return;
+    }
+    s->out[s->out_size++] = (struct node){op, token, val};
+}
+
+void ssa_load(struct ssa* s, int v) {
+    struct ssa_val* x = &s->vals[v];
+    if (ssa_remat(x)) {
+        ssa_push(s, x->op, NULL, x->val);
+        return;
+    }
+    ssa_push(s, OP_PUSH_VARADDR, NULL, x->slot);
+    ssa_push(s, OP_GLOBAL_GET, NULL, 0);
+}
+
+// Pushes what v takes from memory rather than from the stack. A slotted
+// value's address goes below the first stacked operand its computation
+// starts with, so the store needs no stack shuffling.
+void ssa_operands(struct ssa* s, int v) {
+    struct ssa_val* x = &s->vals[v];
+    if (x->addr_for != -1)
+        ssa_push(s, OP_PUSH_VARADDR, NULL, s->vals[x->addr_for].slot);
+    for (int k = x->stack_args; k < x->arg_size; k++)
+        ssa_load(s, ssa_find(s, s->args[x->arg + k]));
+}
+
+void ssa_op(struct ssa* s, int v) {
+    struct ssa_val* x = &s->vals[v];
+    if (x->kind == SSA_NODE)
+        ssa_push(s, x->op, x->token, x->val);
+    if (ssa_slotted(s, v))
+        ssa_push(s, OP_GLOBAL_SET, NULL, 0);
+}
+
+// Moves the operands block b passes to the phis of its successor j into the
+// phis' slots as one parallel copy: a slot another pending copy still reads
+// is written last, and a cycle is broken through the scratch slot. Copies to
+// a branch target go before the branch, so such a phi must not be live on
+// the fallthrough edge.
+void ssa_copies(struct ssa* s, int b, int j) {
+    struct ssa_block* bl = &s->blocks[b];
+    int t = bl->succ[j];
+    int k = ssa_pred_index(s, t, b);
+    int size = 0;
+    if (j == 1 && t == bl->succ[0])
+        return;
+    for (int p = s->blocks[t].phis; p != -1; p = s->vals[p].next) {
+        int v = ssa_find(s, s->args[s->vals[p].arg + k]);
+        struct ssa_val* x = &s->vals[v];
+        if (!ssa_slotted(s, p) || v == p || (ssa_slotted(s, v) && x->slot == s->vals[p].slot))
+            continue;
+        if (size == SSA_COPIES || (j == 0 && ssa_after_branch(s, b, bl->succ[1]) && ssa_live_edge(s, b, bl->succ[1], p, -1))) {
+            s->fail = true;
+            return;
+        }
+        s->copies[size++] = (struct ssa_copy){s->vals[p].slot, ssa_remat(x) ? -1 : x->slot, v, false};
+    }
+    for (int left = size; left > 0;) {
+        int pick = -1;
+        for (int i = 0; pick == -1 && i < size; i++) {
+            bool blocked = false;
+            for (int j = 0; !s->copies[i].done && j < size; j++)
+                blocked = blocked || (!s->copies[j].done && j != i && s->copies[j].src == s->copies[i].dst);
+            if (!s->copies[i].done && !blocked)
+                pick = i;
+        }
+        if (pick == -1) {
+            for (int i = 0; pick == -1 && i < size; i++) {
+                if (!s->copies[i].done)
+                    pick = i;
+            }
+            ssa_push(s, OP_PUSH_VARADDR, NULL, s->scratch);
+            ssa_push(s, OP_PUSH_VARADDR, NULL, s->copies[pick].dst);
+            ssa_push(s, OP_GLOBAL_GET, NULL, 0);
+            ssa_push(s, OP_GLOBAL_SET, NULL, 0);
+            for (int j = 0; j < size; j++) {
+                if (s->copies[j].src == s->copies[pick].dst)
+                    s->copies[j].src = s->scratch;
+            }
+            continue;
+        }
+        struct ssa_copy* c = &s->copies[pick];
+        ssa_push(s, OP_PUSH_VARADDR, NULL, c->dst);
+        if (c->src == -1) {
+            ssa_load(s, c->from);
+        } else {
+            ssa_push(s, OP_PUSH_VARADDR, NULL, c->src);
+            ssa_push(s, OP_GLOBAL_GET, NULL, 0);
+        }
+        ssa_push(s, OP_GLOBAL_SET, NULL, 0);
+        c->done = true;
+        left--;
+    }
+}
+
+// Writes the function back as nodes, block by block in source order.
+void ssa_lower(struct ssa* s, struct node* nodes) {
+    for (int b = 0; b < s->block_size && !s->fail; b++) {
+        struct ssa_block* bl = &s->blocks[b];
+        int term = -1;
+        if (!bl->reach)
+            continue;
+        if (nodes[bl->start].op == OP_LABEL)
+            ssa_push(s, OP_LABEL, nodes[bl->start].token, nodes[bl->start].val);
+        for (int v = bl->head; v != -1; v = s->vals[v].next) {
+            if (!ssa_emitted(&s->vals[v]))
+                continue;
+            if (ssa_term(&s->vals[v])) {
+                term = v;
+                continue;
+            }
+            ssa_operands(s, v);
+            ssa_op(s, v);
+        }
+        if (term != -1)
+            ssa_operands(s, term);
+        if (bl->succ_size > 0)
+            ssa_copies(s, b, 0);
+        if (term != -1)
+            ssa_op(s, term);
+        if (bl->succ_size > 1)
+            ssa_copies(s, b, 1);
+    }
+}
+
+// Runs the SSA passes over one function, from its label up to its end
+// marker, appending the result to the output. Returns false, leaving the
+// output as it was, when the function does not fit the model or comes out
+// longer than it went in.
+bool ssa_fn(struct ssa* s, struct node* nodes, struct label* labels, int start, int end) {
+    int size = s->out_size;
+    int merged = s->merged;
+    int removed = s->removed;
+    int base = 0;
+    s->mark++;
+    s->fail = false;
+    s->val_size = 1;
+    s->arg_size = SSA_DEPTH;
+    s->def_size = 0;
+    s->entry_head = -1;
+    s->entry_tail = -1;
+    s->vals[0] = (struct ssa_val){.repl = -1, .next = -1, .inc = -1, .user = -1, .first = -1, .addr_for = -1, .slot = -1, .dense = -1};
+    for (int i = start; i < end; i++) {
+        if (nodes[i].op == OP_PUSH_VARADDR && nodes[i].val >= base)
+            base = nodes[i].val + 1;
+    }
+    if (!ssa_blocks(s, nodes, start, end) || !ssa_depths(s, nodes, labels))
+        return false;
+    ssa_promote(s, nodes, labels);
+    ssa_build(s, nodes, labels);
+    if (s->fail)
+        return false;
+    ssa_dominators(s);
+    ssa_gvn(s, 0);
+    ssa_dce(s);
+    ssa_uses(s);
+    ssa_stackify(s);
+    for (int v = 1; v < s->val_size; v++) {
+        struct ssa_val* x = &s->vals[v];
+        if (x->kind == SSA_READ && x->live && x->repl == -1 && !x->stacked)
+            x->repl = ssa_find(s, s->args[x->arg]);
+    }
+    ssa_uses(s);
+    ssa_positions(s);
+    if (!s->fail && ssa_liveness(s)) {
+        ssa_intervals(s);
+        if (ssa_slots(s, base))
+            ssa_lower(s, nodes);
+        else
+            s->fail = true;
+        if (s->out_size - size > end - start)
+            s->fail = true;
+    } else {
+        s->fail = true;
+    }
+    if (s->fail) {
+        s->out_size = size;
+        s->merged = merged;
+        s->removed = removed;
+    }
+    return !s->fail;
+}
+
+// Rebuilds every function in SSA form, where global value numbering, dead
+// code elimination and copy propagation are simple, and lowers it back to
+// stack nodes for the passes that follow. Functions it cannot model are
+// copied as they are. Returns the number of functions rebuilt.
+int analyze_ssa(struct node* nodes, struct label* labels, int* merged, int* removed) {
+    struct ssa* s = &ssa;
+    int start = -1;
+    int fns = 0;
+    int i = 0;
+    s->out_size = 0;
+    s->full = false;
+    s->merged = 0;
+    s->removed = 0;
+    for (; nodes[i].op != OP_NULL; i++) {
+        struct node* n = &nodes[i];
+        if (n->op == OP_LABEL && labels[n->val].token != NULL) {
+            for (int j = start; start != -1 && j < i; j++)
+                ssa_push(s, nodes[j].op, nodes[j].token, nodes[j].val);
+            start = i;
+        } else if (start == -1) {
+            ssa_push(s, n->op, n->token, n->val);
+        } else if (n->op == OP_LABEL_FNEND) {
+            if (ssa_fn(s, nodes, labels, start, i))
+                fns++;
+            else
+                for (int j = start; j < i; j++)
+                    ssa_push(s, nodes[j].op, nodes[j].token, nodes[j].val);
+            ssa_push(s, n->op, n->token, n->val);
+            start = -1;
+        }
+    }
+    for (int j = start; start != -1 && j < i; j++)
+        ssa_push(s, nodes[j].op, nodes[j].token, nodes[j].val);
+    if (s->full) {
+        *merged = 0;
+        *removed = 0;
+        return 0;
+    }
+    for (int j = 0; j < s->out_size; j++)
+        nodes[j] = s->out[j];
+    nodes[s->out_size] = (struct node){OP_NULL, NULL, 0};
+    *merged = s->merged;
+    *removed = s->removed;
+    return fns;
+}
+
+void build_blocks(struct loop_opt* lo, struct node* nodes, int start, int end) {
+    lo->block_size = 0;
+    for (int i = start; i < end; i++) {
+        bool split = i == start || nodes[i].op == OP_LABEL;
+        enum op prev = i == start ? OP_NULL : nodes[i - 1].op;
+        split = split || prev == OP_JMP || prev == OP_JZE || prev == OP_RETURN || prev == OP_TAILCALL;
+        if (split) {
+            if (lo->block_size != 0)
+                lo->blocks[lo->block_size - 1].end = i;
+            lo->blocks[lo->block_size++] = (struct block){.start = i, .pred_min = -1, .pred_max = -1, .back = -1};
+        }
+        if (nodes[i].op == OP_LABEL)
+            lo->lab_block[nodes[i].val] = lo->block_size - 1;
+    }
+    if (lo->block_size != 0)
+        lo->blocks[lo->block_size - 1].end = end;
+    for (int i = 0; i < lo->block_size; i++) {
+        struct block* bl = &lo->blocks[i];
+        struct node* last = &nodes[bl->end - 1];
+        bl->succ_size = 0;
+        if ((last->op == OP_JMP || last->op == OP_JZE) && last->val >= 0)
+            bl->succ[bl->succ_size++] = lo->lab_block[last->val];
+        if (last->op != OP_JMP && last->op != OP_RETURN && last->op != OP_TAILCALL && i + 1 < lo->block_size)
+            bl->succ[bl->succ_size++] = i + 1;
+    }
+    for (int i = 0; i < lo->block_size; i++) {
+        for (int j = 0; j < lo->blocks[i].succ_size; j++) {
+            struct block* s = &lo->blocks[lo->blocks[i].succ[j]];
+            if (s->pred_min == -1 || i < s->pred_min)
+                s->pred_min = i;
+            if (i > s->pred_max)
+                s->pred_max = i;
+            if (lo->blocks[i].succ[j] <= i && i > s->back)
+                s->back = i;
+        }
+    }
+}
+
+int loop_var(struct loop_opt* lo, int off) {
+    int x = off + STK_SZ;
+    if (x < 0 || x >= 2 * STK_SZ)
+        return -1;
+    if (lo->var_mark[x] != lo->mark) {
+        lo->var_mark[x] = lo->mark;
+        lo->var_writes[x] = 0;
+        lo->var_update[x] = -1;
+    }
+    return x;
+}
+
+bool same_expr(struct node* nodes, int a, int b, int size) {
+    for (int i = 0; i < size; i++) {
+        if (nodes[a + i].op != nodes[b + i].op || nodes[a + i].val != nodes[b + i].val)
+            return false;
+    }
+    return true;
+}
+
+void loop_cand(struct loop_opt* lo, struct node* nodes, struct loop_val* v, int end) {
+    int size = end - v->start;
+    if (size <= 2 || lo->cand_size == LOOP_EXPRS)
+        return;
+    int e = 0;
+    for (; e < lo->expr_size; e++) {
+        struct loop_expr* x = &lo->exprs[e];
+        if (x->end - x->start == size && same_expr(nodes, x->start, v->start, size))
+            break;
+    }
+    if (e == lo->expr_size) {
+        lo->exprs[lo->expr_size++] = (struct loop_expr){v->start, end, -1, 0, v->kind, v->iv, v->coef};
+    }
+    lo->exprs[e].uses++;
+    lo->cands[lo->cand_size++] = (struct loop_cand){v->start, end, e};
+}
+
+struct loop_val loop_result(struct loop_opt* lo, struct node* nodes, int i, struct loop_val* ops, int pops, bool entry) {
+    struct node* n = &nodes[i];
+    struct loop_val r = {VAL_OTHER, pops > 0 ? ops[0].start : i, 0, 0, false, 0, 0};
+    bool inv = true;
+    for (int k = 0; k < pops; k++)
+        inv = inv && ops[k].kind == VAL_INV;
+    if (n->op == OP_PUSH_CONST) {
+        r = (struct loop_val){VAL_INV, i, 0, 0, true, n->val, 0};
+    } else if (n->op == OP_PUSH_VARADDR) {
+        r.kind = VAL_INV;
+    } else if (n->op == OP_GLOBAL_GET && ops[0].start == i - 1 && nodes[i - 1].op == OP_PUSH_VARADDR) {
+        int x = loop_var(lo, nodes[i - 1].val);
+        if (x == -1) {
+            r.kind = VAL_OTHER;
+        } else if (lo->var_writes[x] == 0) {
+            r.kind = VAL_INV;
+        } else if (lo->var_writes[x] == 1 && lo->var_update[x] != -1) {
+            r.kind = VAL_IV;
+            r.iv = x;
+            r.coef = 1;
+        }
+    } else if (n->op == OP_GLOBAL_GET || n->op == OP_VEC_SIZE || n->op == OP_VEC_GET || n->op == OP_LOAD8) {
+        if (inv && entry && !lo->clobber)
+            r.kind = VAL_INV;
+    } else if (n->op == OP_DIV || n->op == OP_MOD) {
+        if (inv && entry)
+            r.kind = VAL_INV;
+    } else if (n->op == OP_ADD || n->op == OP_SUB || n->op == OP_MUL) {
+        struct loop_val* a = &ops[0];
+        struct loop_val* b = &ops[1];
+        if (inv) {
+            r.kind = VAL_INV;
+        } else if (n->op == OP_MUL) {
+            struct loop_val* iv = a->kind == VAL_IV ? a : b;
+            struct loop_val* c = a->kind == VAL_IV ? b : a;
+            if (iv->kind == VAL_IV && c->is_const && c->cval != 0)
+                r = (struct loop_val){VAL_IV, r.start, iv->iv, iv->coef * c->cval, false, 0, 0};
+        } else if (a->kind == VAL_IV && b->kind == VAL_INV) {
+            r = (struct loop_val){VAL_IV, r.start, a->iv, a->coef, false, 0, 0};
+        } else if (a->kind == VAL_INV && b->kind == VAL_IV) {
+            r = (struct loop_val){VAL_IV, r.start, b->iv, n->op == OP_SUB ? -b->coef : b->coef, false, 0, 0};
+        }
+    } else if (n->op >= OP_EQ && n->op <= OP_GT) {
+        if (inv)
+            r.kind = VAL_INV;
+    }
+    return r;
+}
+
+// Walks the loop body twice. The first pass finds the variables written in
+// the loop, the induction updates &i = i + c and whether anything may store
+// through a computed address. The second pass tracks, for each stack value,
+// whether it is loop invariant or affine in one induction variable, and
+// records the largest such subexpressions as candidates. A value must be
+// computed by one contiguous run of nodes, which an address left on the stack
+// below an inlined call is not.
+bool loop_scan(struct loop_opt* lo, struct node* nodes, struct label* labels, int h, int b, bool escapes) {
+    struct loop_val vals[INLINE_DEPTH];
+    lo->mark++;
+    lo->clobber = false;
+    lo->expr_size = 0;
+    lo->cand_size = 0;
+    for (int pass = 0; pass < 2; pass++) {
+        int depth = 0;
+        bool live = true;
+        bool entry = true;
+        for (int i = h + 1; i <= b; i++) {
+            if (nodes[i].op == OP_LABEL)
+                lo->lab_depth[nodes[i].val] = -1;
+        }
+        for (int i = h + 1; i <= b; i++) {
+            struct node* n = &nodes[i];
+            if (n->op == OP_LABEL) {
+                if (!live && lo->lab_depth[n->val] == -1)
+                    return false;
+                if (!live)
+                    depth = lo->lab_depth[n->val];
+                for (int k = 0; k < depth; k++)
+                    vals[k].kind = VAL_OTHER;
+                live = true;
+                entry = false;
+                continue;
+            }
+            if (!live || (n->op == OP_RETURN && depth == 0)) {
+                live = false;
+                continue;
+            }
+            if (pass == 0 && n->op == OP_PUSH_VARADDR && nodes[i + 1].op != OP_GLOBAL_GET) {
+                int x = loop_var(lo, n->val);
+                struct node* u = &nodes[i + 1];
+                if (x != -1)
+                    lo->var_writes[x]++;
+                if (x != -1 && u[0].op == OP_PUSH_VARADDR && u[0].val == n->val && u[1].op == OP_GLOBAL_GET && u[2].op == OP_PUSH_CONST &&
+                    (u[3].op == OP_ADD || u[3].op == OP_SUB) && u[4].op == OP_GLOBAL_SET) {
+                    lo->var_update[x] = i + 5;
+                    lo->var_step[x] = u[3].op == OP_ADD ? u[2].val : -u[2].val;
+                }
+            }
+            if (pass == 0 && (n->op == OP_CALL || n->op == OP_TAILCALL || n->op == OP_SVC || n->op == OP_SVCK || n->op == OP_VEC_INIT ||
+                              n->op == OP_VEC_SET || n->op == OP_VEC_PUSH || n->op == OP_VEC_POP || n->op == OP_STORE8))
+                lo->clobber = true;
+            int pops = node_pops(n, labels);
+            int pushes = pops + node_effect(n, labels);
+            if (pops > depth || depth - pops + pushes > INLINE_DEPTH)
+                return false;
+            depth -= pops;
+            struct loop_val* ops = &vals[depth];
+            if (pass == 0 && n->op == OP_GLOBAL_SET && !(ops[0].start + 1 == ops[1].start && nodes[ops[0].start].op == OP_PUSH_VARADDR))
+                lo->clobber = true;
+            struct loop_val r = loop_result(lo, nodes, i, ops, pops, entry);
+            r.end = i + 1;
+            for (int k = 0; k < pops; k++) {
+                if (ops[k].end != (k + 1 < pops ? ops[k + 1].start : i))
+                    r.kind = VAL_OTHER;
+            }
+            if (pass == 1) {
+                for (int k = 0; k < pops; k++) {
+                    bool absorbed = (r.kind == VAL_INV && ops[k].kind == VAL_INV) || (r.kind == VAL_IV && ops[k].kind != VAL_OTHER);
+                    if (ops[k].kind != VAL_OTHER && !absorbed)
+                        loop_cand(lo, nodes, &ops[k], ops[k].end);
+                }
+            }
+            if (pushes > 0)
+                vals[depth] = r;
+            depth += pushes;
+            if (n->op == OP_JMP || n->op == OP_JZE) {
+                if (n->val >= 0)
+                    lo->lab_depth[n->val] = depth;
+                entry = false;
+            }
+            if (n->op == OP_JMP || n->op == OP_RETURN)
+                live = false;
+        }
+        if (pass == 0 && escapes && lo->clobber)
+            return false;
+    }
+    return true;
+}
+
+void loop_edit(struct loop_opt* lo, enum edit_kind kind, int pos, int end, int expr) {
+    int i = lo->edit_size++;
+    for (; i > lo->edit_start; i--) {
+        struct loop_edit* e = &lo->edits[i - 1];
+        if (e->pos < pos || (e->pos == pos && e->kind <= kind))
+            break;
+        lo->edits[i] = *e;
+    }
+    lo->edits[i] = (struct loop_edit){.kind = kind, .pos = pos, .end = end, .expr = expr};
+}
+
+// Turns the candidates of one loop into edits. An invariant is always worth a
+// slot. An induction expression costs a six-node step after each update of
+// its variable, so it needs enough uses to pay for that.
+void loop_plan(struct loop_opt* lo, int h, int* slot, int* hoisted, int* reduced) {
+    lo->edit_start = lo->edit_size;
+    for (int e = 0; e < lo->expr_size; e++) {
+        struct loop_expr* x = &lo->exprs[e];
+        int size = x->end - x->start;
+        if (x->kind == VAL_IV && x->uses * (size - 2) <= LOOP_STEP_COST)
+            continue;
+        if (*slot + 1 > TMP_FRAME || lo->edit_size + x->uses + 2 > (int)(COMP_SZ / sizeof(struct node)))
+            continue;
+        x->slot = (*slot)++;
+        loop_edit(lo, EDIT_PRE, h, 0, e);
+        if (x->kind == VAL_IV) {
+            loop_edit(lo, EDIT_STEP, lo->var_update[x->iv] + 1, 0, e);
+            lo->steps[e] = x->coef * lo->var_step[x->iv];
+            (*reduced)++;
+        } else {
+            (*hoisted)++;
+        }
+    }
+    for (int c = 0; c < lo->cand_size; c++) {
+        struct loop_cand* cand = &lo->cands[c];
+        if (lo->exprs[cand->expr].slot != -1)
+            loop_edit(lo, EDIT_LOAD, cand->start, cand->end, cand->expr);
+    }
+    for (int i = lo->edit_start; i < lo->edit_size; i++) {
+        struct loop_edit* e = &lo->edits[i];
+        struct loop_expr* x = &lo->exprs[e->expr];
+        e->slot = x->slot;
+        e->start = x->start;
+        e->size = x->end - x->start;
+        e->step = e->kind == EDIT_STEP ? lo->steps[e->expr] : 0;
+    }
+}
+
+void loop_push(struct loop_opt* lo, enum op op, int val) {
+    lo->out[lo->out_size++] = (struct node){op, NULL, val};
+}
+
+// Hoists loop-invariant expressions into a slot set before the loop header and
+// strength-reduces expressions affine in an induction variable into a slot
+// stepped next to the variable. Only innermost, single-entry loops are
+// touched, and memory loads move only from the part of the body that runs on
+// every iteration, when nothing in the loop can store to memory. Functions
+// with a match are left as they are.
+void analyze_loops(struct node* nodes, struct label* labels, int* hoisted, int* reduced) {
+    struct loop_opt* lo = &loop_opt;
+    int node_size = 0;
+    int fn = -1;
+    *hoisted = 0;
+    *reduced = 0;
+    lo->edit_size = 0;
+    for (; nodes[node_size].op != OP_NULL; node_size++) {
+        struct node* n = &nodes[node_size];
+        if (n->op == OP_LABEL && labels[n->val].token != NULL) {
+            fn = node_size;
+            continue;
+        }
+        if (n->op != OP_LABEL_FNEND || fn == -1)
+            continue;
+        int slot = 0;
+        bool multi = false;
+        for (int i = fn; i < node_size; i++) {
+            if (nodes[i].op == OP_PUSH_VARADDR && nodes[i].val >= slot)
+                slot = nodes[i].val + 1;
+            multi = multi || nodes[i].op == OP_SWITCH;
+        }
+        if (multi) {
+            fn = -1;
+            continue;
+        }
+        bool escapes = frame_escapes(nodes, fn + 1, node_size, labels, lo->lab_depth);
+        build_blocks(lo, nodes, fn, node_size);
+        for (int hb = 1; hb < lo->block_size; hb++) {
+            struct block* hdr = &lo->blocks[hb];
+            int last = hdr->back;
+            enum op pre = nodes[lo->blocks[hb - 1].end - 1].op;
+            if (last == -1 || nodes[hdr->start].op != OP_LABEL)
+                continue;
+            bool ok = hdr->pred_min == hb - 1 && pre != OP_JMP && pre != OP_JZE;
+            for (int j = hb + 1; ok && j <= last; j++) {
+                struct block* bl = &lo->blocks[j];
+                ok = bl->pred_min >= hb && bl->pred_max <= last;
+                for (int k = 0; ok && k < bl->succ_size; k++)
+                    ok = !(bl->succ[k] > hb && bl->succ[k] <= j);
+            }
+            if (ok && loop_scan(lo, nodes, labels, hdr->start, lo->blocks[last].end - 1, escapes))
+                loop_plan(lo, hdr->start, &slot, hoisted, reduced);
+        }
+        fn = -1;
+    }
+    if (lo->edit_size == 0)
+        return;
+    int grow = 0;
+    for (int i = 0; i < lo->edit_size; i++) {
+        struct loop_edit* e = &lo->edits[i];
+        grow += e->kind == EDIT_PRE ? e->size + 2 : e->kind == EDIT_STEP ? LOOP_STEP_COST : 2 - e->size;
+    }
+    if (node_size + grow >= (int)(COMP_SZ / sizeof(struct node))) {
+        *hoisted = 0;
+        *reduced = 0;
+        return;
+    }
+    lo->out_size = 0;
+    int k = 0;
+    for (int i = 0; i < node_size; i++) {
+        for (; k < lo->edit_size && lo->edits[k].pos == i && lo->edits[k].kind != EDIT_LOAD; k++) {
+            struct loop_edit* e = &lo->edits[k];
+            loop_push(lo, OP_PUSH_VARADDR, e->slot);
+            if (e->kind == EDIT_PRE) {
+                for (int j = 0; j < e->size; j++)
+                    lo->out[lo->out_size++] = nodes[e->start + j];
+            } else {
+                loop_push(lo, OP_PUSH_VARADDR, e->slot);
+                loop_push(lo, OP_GLOBAL_GET, 0);
+                loop_push(lo, OP_PUSH_CONST, e->step);
+                loop_push(lo, OP_ADD, 0);
+            }
+            loop_push(lo, OP_GLOBAL_SET, 0);
+        }
+        if (k < lo->edit_size && lo->edits[k].pos == i) {
+            loop_push(lo, OP_PUSH_VARADDR, lo->edits[k].slot);
+            loop_push(lo, OP_GLOBAL_GET, 0);
+            i = lo->edits[k++].end - 1;
+            continue;
+        }
+        lo->out[lo->out_size++] = nodes[i];
+    }
+    for (int i = 0; i < lo->out_size; i++)
+        nodes[i] = lo->out[i];
+    nodes[lo->out_size] = (struct node){OP_NULL, NULL, 0};
+}
+
+// Matches the step parse_for ends a loop with, &i = i + 1; JMP start, when
+// start tests i < N for a constant N and the loop's exit label follows the
+// jump. Returns the LABEL start node, or NULL.
+struct node* for_head(struct node* nodes, struct node* n) {
+    if (n[1].op != OP_PUSH_VARADDR || n[1].val != n->val || n[2].op != OP_GLOBAL_GET || n[3].op != OP_PUSH_CONST || n[3].val != 1 ||
+        n[4].op != OP_ADD || n[5].op != OP_GLOBAL_SET || n[6].op != OP_JMP)
+        return NULL;
+    struct node* h = n;
+    while (h > nodes && h->op != OP_LABEL_FNEND && !(h->op == OP_LABEL && h->val == n[6].val))
+        h--;
+    if (h->op != OP_LABEL || h->val != n[6].val || h[1].op != OP_PUSH_VARADDR || h[1].val != n->val || h[2].op != OP_GLOBAL_GET ||
+        h[3].op != OP_PUSH_CONST || h[4].op != OP_LT || h[5].op != OP_JZE)
+        return NULL;
+    for (struct node* e = n + 7; e->op == OP_LABEL; e++) {
+        if (e->val == h[5].val)
+            return h;
+    }
+    return NULL;
+}
+
+// Whether match m becomes a jump table indexed by key, OP_SWITCH, rather
+// than a binary search over its keys, OP_SEARCH. A table may hold at most
+// twice as many entries as the match has arms.
+bool match_dense(int m) {
+    struct matches* t = &matches;
+    int* keys = &t->key[t->first[m]];
+    int size = t->size[m];
+    return size != 0 && (long)keys[size - 1] - keys[0] < 2L * size;
+}
+
+void match_case(union mem* at, int key, int lab) {
+    at[0] = (union mem){.op = OP_CASE};
+    at[1] = (union mem){.val = key};
+    at[2] = (union mem){.val = lab};
+}
+
+// Writes from at the OP_CASE key target entries that follow the OP_SWITCH or
+// OP_SEARCH of match m: one per arm, or one per key from the lowest to the
+// highest for a jump table, then the default. Returns the entry count before
+// the default.
+int match_cases(union mem* at, int m) {
+    struct matches* t = &matches;
+    int* keys = &t->key[t->first[m]];
+    int* labs = &t->lab[t->first[m]];
+    int size = t->size[m];
+    bool dense = match_dense(m);
+    int count = 0;
+    for (int i = 0; i < size; i++) {
+        for (int k = keys[0] + count; dense && k < keys[i]; k++)
+            match_case(&at[3 * count++], k, labs[size]);
+        match_case(&at[3 * count++], keys[i], labs[i]);
+    }
+    match_case(&at[3 * count], 0, labs[size]);
+    return count;
+}
+
+// With checked set every instruction is preceded by OP_CHECK, which tests
+// what the instruction is about to touch before it runs. With compact set a
+// small constant or a frame offset is pushed by a single word that holds it
+// above OP_PUSH_SMALL or OP_PUSH_LOCAL. The step and jump back of a counted
+// loop become one OP_FOR, which increments the counter in its frame slot and
+// goes straight to the body past the test while it is below the bound;
+// profiled images keep the jump so its edge is counted.
+void to_instructions(union mem* mem, struct node* nodes, struct label* labels, struct debug* debug, const char* src, bool checked, bool compact) {
+    union mem* iptr = mem + GLOB_SZ;
+    struct token* tok = NULL;
+    const char* cur = NULL;
+    struct line pos;
+    struct node* head;
+    init_lines(debug);
+    pgo.site_size = 0;
+    for (struct node* n = nodes; n->op != OP_NULL; n++) {
+        if (n->token != NULL)
+            tok = n->token;
+        if (n->op == OP_LABEL) {
+            labels[n->val].inst_index = iptr - mem;
+            if (labels[n->val].token != NULL)
+                tok = labels[n->val].token;
+            continue;
+        }
+        if (tok != NULL && n->op != OP_NOP) {
+            src_pos(src, &cur, tok->data, &pos);
+            pos.inst_index = iptr - mem;
+            add_line(debug, &pos);
+        }
+        if (checked && n->op != OP_NOP)
+            *(iptr++) = (union mem){.op = OP_CHECK};
+        if (pgo.on && (n->op == OP_JMP || n->op == OP_JZE || n->op == OP_JNZ)) {
+            *(iptr++) = (union mem){.op = OP_PROFILE};
+            pgo_site(iptr - mem, 1, PGO_LABEL, labels[n->val].origin, labels[n->val].ordinal);
+        } else if (pgo.on && (n->op == OP_CALL || n->op == OP_TAILCALL)) {
+            *(iptr++) = (union mem){.op = OP_PROFILE};
+            pgo_site(iptr - mem, 1, PGO_CALL, n->token, 0);
+        }
+        if (n->op == OP_PUSH_VARADDR && !pgo.on && (head = for_head(nodes, n)) != NULL) {
+            int body = labels[head->val].inst_index;
+            while (mem[body].op != OP_JZE)
+                body += inst_size(mem[body].op);
+            *(iptr++) = (union mem){.op = OP_FOR};
+            *(iptr++) = (union mem){.val = n->val};
+            *(iptr++) = (union mem){.val = head[3].val};
+            *(iptr++) = (union mem){.val = body + 2};
+            n += 6;
+        } else if (compact && n->op == OP_PUSH_CONST && n->val >= -SMALL_SZ / 2 && n->val < SMALL_SZ / 2) {
+            *(iptr++) = (union mem){.val = OP_PUSH_SMALL + SMALL_SZ / 2 + n->val};
+        } else if (compact && n->op == OP_PUSH_VARADDR && n->val >= -STK_SZ && n->val < STK_SZ) {
+            *(iptr++) = (union mem){.val = OP_PUSH_LOCAL + STK_SZ + n->val};
+        } else if (n->op == OP_PUSH_CONST || n->op == OP_PUSH_VARADDR || n->op == OP_JMP || n->op == OP_JZE || n->op == OP_JNZ) {
+            *(iptr++) = (union mem){.op = n->op};
+            *(iptr++) = (union mem){.val = n->val};
+        } else if (n->op == OP_CALL || n->op == OP_SVCK) {
+            *(iptr++) = (union mem){.op = n->op};
+            *(iptr++) = (union mem){.val = n->val};
+        } else if (n->op == OP_SWITCH) {
+            int count = match_cases(iptr + 2, n->val);
+            iptr[0] = (union mem){.op = match_dense(n->val) ? OP_SWITCH : OP_SEARCH};
+            iptr[1] = (union mem){.val = count};
+            iptr += 2 + 3 * (count + 1);
+        } else if (n->op == OP_TAILCALL) {
+            *(iptr++) = (union mem){.op = n->op};
+            *(iptr++) = (union mem){.val = n->val};
+            *(iptr++) = (union mem){.val = labels[n->val].arg_size};
+        } else if (n->op == OP_NOP) {
+            continue;
+        } else {
+            *(iptr++) = (union mem){.op = n->op};
+        }
+    }
+    mem[GLOBAL_IP].val = GLOB_SZ;
+    mem[GLOBAL_BP].val = iptr - mem;
+    mem[GLOBAL_SP].val = (iptr - mem) + STK_SZ;
+}
+
+// Operand stack slot for depth d in the register encoding. Operands live in
+// the upper half of the frame, above every local, so the area the stack VM
+// used for its operand stack stays free for calls and for memory callers
+// reserve through the frame linkage.
+int reg_slot(int d) {
+    return REG_STACK + d;
+}
+
+void reg_op(struct reg_gen* g, enum op op) {
+    if (g->tok != NULL) {
+        src_pos(g->src, &g->cur, g->tok->data, &g->pos);
+        g->pos.inst_index = g->iptr - g->mem;
+        add_line(g->debug, &g->pos);
+    }
+    g->last = NULL;
+    *(g->iptr++) = (union mem){.op = op};
+}
+
+void reg_word(struct reg_gen* g, int x) {
+    *(g->iptr++) = (union mem){.val = x};
+}
+
+// Emits an instruction writing slot dst and remembers where dst went, so a
+// store of the result into a local can retarget it instead of copying.
+void reg_def(struct reg_gen* g, enum op op, int dst) {
+    reg_op(g, op);
+    g->last = g->iptr;
+    reg_word(g, dst);
+}
+
+void reg_spill(struct reg_gen* g, int i) {
+    struct reg_val* x = &g->stack[i];
+    if (x->kind == REG_CONST)
+        reg_def(g, OP_MOVK, reg_slot(i));
+    else if (x->kind == REG_LOCAL)
+        reg_def(g, OP_MOV, reg_slot(i));
+    else if (x->kind == REG_ADDR)
+        reg_def(g, OP_LEA, reg_slot(i));
+    else
+        return;
+    reg_word(g, x->val);
+    *x = (struct reg_val){REG_TEMP, 0};
+}
+
+// Moves every operand below depth end into its slot, as control flow and
+// calls expect.
+void reg_flush(struct reg_gen* g, int end) {
+    for (int i = 0; i < end; i++)
+        reg_spill(g, i);
+}
+
+// Loads the deferred reads of local off below depth end, or of any local
+// when off is -1, before something writes it.
+void reg_clobber(struct reg_gen* g, int end, int off, bool any) {
+    for (int i = 0; i < end; i++) {
+        if (g->stack[i].kind == REG_LOCAL && (any || g->stack[i].val == off))
+            reg_spill(g, i);
+    }
+}
+
+int reg_operand(struct reg_gen* g, int i) {
+    if (g->stack[i].kind == REG_LOCAL)
+        return g->stack[i].val;
+    reg_spill(g, i);
+    return reg_slot(i);
+}
+
+bool reg_commutes(enum op op) {
+    return op == OP_OR || op == OP_AND || op == OP_EQ || op == OP_NE || op == OP_ADD || op == OP_MUL;
+}
+
+void reg_binop(struct reg_gen* g, enum op op) {
+    int i = g->depth - 2;
+    struct reg_val x = g->stack[i];
+    struct reg_val y = g->stack[i + 1];
+    if (y.kind == REG_CONST) {
+        int a = reg_operand(g, i);
+        reg_def(g, op - OP_OR + OP_ORK, reg_slot(i));
+        reg_word(g, a);
+        reg_word(g, y.val);
+    } else if (x.kind == REG_CONST && (reg_commutes(op) || op == OP_LT || op == OP_GT)) {
+        int a = reg_operand(g, i + 1);
+        if (op == OP_LT || op == OP_GT)
+            op = op == OP_LT ? OP_GT : OP_LT;
+        reg_def(g, op - OP_OR + OP_ORK, reg_slot(i));
+        reg_word(g, a);
+        reg_word(g, x.val);
+    } else {
+        int a = reg_operand(g, i);
+        int b = reg_operand(g, i + 1);
+        reg_def(g, op, reg_slot(i));
+        reg_word(g, a);
+        reg_word(g, b);
+    }
+    g->stack[i] = (struct reg_val){REG_TEMP, 0};
+    g->depth--;
+}
+
+void reg_set(struct reg_gen* g) {
+    int i = g->depth - 2;
+    struct reg_val x = g->stack[i];
+    struct reg_val y = g->stack[i + 1];
+    g->depth -= 2;
+    if (x.kind != REG_ADDR) {
+        reg_clobber(g, i, 0, true);
+        int a = reg_operand(g, i);
+        int b = reg_operand(g, i + 1);
+        reg_op(g, OP_STORE);
+        reg_word(g, a);
+        reg_word(g, b);
+        return;
+    }
+    bool read = false;
+    for (int k = 0; k < i; k++)
+        read = read || (g->stack[k].kind == REG_LOCAL && g->stack[k].val == x.val);
+    if (y.kind == REG_TEMP && !read && g->last != NULL && g->last->val == reg_slot(i + 1)) {
+        g->last->val = x.val;
+        g->last = NULL;
+        return;
+    }
+    reg_clobber(g, i, x.val, false);
+    if (y.kind == REG_TEMP)
+        y.val = reg_slot(i + 1);
+    reg_op(g, y.kind == REG_CONST ? OP_MOVK : y.kind == REG_ADDR ? OP_LEA : OP_MOV);
+    reg_word(g, x.val);
+    reg_word(g, y.val);
+}
+
+// Emits a vector op over the top pops operands, the first of which the
+// result replaces. Ops that write memory load the deferred reads below them
+// first.
+void reg_vec(struct reg_gen* g, enum op op, int pops, bool write) {
+    int i = g->depth - pops;
+    int a[3];
+    if (write)
+        reg_clobber(g, i, 0, true);
+    for (int k = 0; k < pops; k++)
+        a[k] = reg_operand(g, i + k);
+    reg_def(g, op, reg_slot(i));
+    for (int k = 0; k < pops; k++)
+        reg_word(g, a[k]);
+    g->stack[i] = (struct reg_val){REG_TEMP, 0};
+    g->depth = i + 1;
+}
+
+void reg_profile(struct reg_gen* g, int word, enum pgo_kind kind, struct token* origin, int ordinal) {
+    if (!pgo.on)
+        return;
+    reg_op(g, OP_PROFILE);
+    pgo_site(g->iptr - g->mem, word, kind, origin, ordinal);
+}
+
+void reg_branch(struct reg_gen* g, int lab) {
+    if (g->depth > g->lab_depth[lab])
+        g->lab_depth[lab] = g->depth;
+}
+
+void reg_label(struct reg_gen* g, int lab) {
+    if (g->reach) {
+        reg_flush(g, g->depth);
+        reg_branch(g, lab);
+    }
+    g->depth = g->labels[lab].token != NULL ? 0 : g->lab_depth[lab] < 0 ? 0 : g->lab_depth[lab];
+    for (int i = 0; i < g->depth; i++)
+        g->stack[i] = (struct reg_val){REG_TEMP, 0};
+    g->labels[lab].inst_index = g->iptr - g->mem;
+    g->last = NULL;
+    g->reach = true;
+}
+
+void reg_node(struct reg_gen* g, struct node* n) {
+    int d = g->depth;
+    int arg_size;
+    switch (n->op) {
+        case OP_PUSH_CONST:
+            g->stack[g->depth++] = (struct reg_val){REG_CONST, n->val};
+            break;
+        case OP_PUSH_VARADDR:
+            g->stack[g->depth++] = (struct reg_val){REG_ADDR, n->val};
+            break;
+        case OP_GLOBAL_GET:
+            if (g->stack[d - 1].kind == REG_ADDR) {
+                g->stack[d - 1].kind = REG_LOCAL;
+            } else {
+                int a = reg_operand(g, d - 1);
+                reg_def(g, OP_LOAD, reg_slot(d - 1));
+                reg_word(g, a);
+                g->stack[d - 1] = (struct reg_val){REG_TEMP, 0};
+            }
+            break;
+        case OP_GLOBAL_SET:
+            reg_set(g);
+            break;
+        case OP_OR:
+        case OP_AND:
+        case OP_EQ:
+        case OP_NE:
+        case OP_LT:
+        case OP_GT:
+        case OP_ADD:
+        case OP_SUB:
+        case OP_MUL:
+        case OP_DIV:
+        case OP_MOD:
+            reg_binop(g, n->op);
+            break;
+        case OP_JMP:
+            reg_flush(g, d);
+            reg_profile(g, 1, PGO_LABEL, g->labels[n->val].origin, g->labels[n->val].ordinal);
+            reg_op(g, OP_JMP);
+            reg_word(g, n->val);
+            reg_branch(g, n->val);
+            g->reach = false;
+            break;
+        case OP_JZE:
+        case OP_JNZ: {
+            reg_flush(g, d - 1);
+            int a = reg_operand(g, d - 1);
+            reg_profile(g, 2, PGO_LABEL, g->labels[n->val].origin, g->labels[n->val].ordinal);
+            reg_op(g, n->op);
+            reg_word(g, a);
+            reg_word(g, n->val);
+            g->depth--;
+            reg_branch(g, n->val);
+            break;
+        }
+        case OP_SWITCH: {
+            reg_flush(g, d - 1);
+            int a = reg_operand(g, d - 1);
+            int count = match_cases(g->iptr + 3, n->val);
+            reg_op(g, match_dense(n->val) ? OP_SWITCH : OP_SEARCH);
+            reg_word(g, a);
+            reg_word(g, count);
+            g->iptr += 3 * (count + 1);
+            g->depth--;
+            for (int k = 0; k <= matches.size[n->val]; k++)
+                reg_branch(g, matches.lab[matches.first[n->val] + k]);
+            g->reach = false;
+            break;
+        }
+        case OP_CALL:
+        case OP_TAILCALL:
+            arg_size = g->labels[n->val].arg_size;
+            reg_flush(g, d);
+            reg_profile(g, 1, PGO_CALL, n->token, 0);
+            reg_op(g, n->op);
+            reg_word(g, n->val);
+            reg_word(g, reg_slot(d - arg_size));
+            reg_word(g, arg_size);
+            g->depth = d - arg_size + 1;
+            g->stack[g->depth - 1] = (struct reg_val){REG_TEMP, 0};
+            break;
+        case OP_RETURN: {
+            int a = d == 0 ? reg_slot(-1) : reg_operand(g, d - 1);
+            reg_op(g, OP_RETURN);
+            reg_word(g, a);
+            g->depth = d == 0 ? 0 : d - 1;
+            g->reach = false;
+            break;
+        }
+        case OP_SVC:
+            reg_spill(g, d - 1);
+            reg_op(g, OP_SVC);
+            reg_word(g, reg_slot(d - 1));
+            break;
+        case OP_SVCK:
+            reg_spill(g, d - 1);
+            reg_op(g, OP_SVCK);
+            reg_word(g, reg_slot(d - 1));
+            reg_word(g, n->val);
+            break;
+        case OP_VEC_INIT:
+            reg_vec(g, n->op, 1, true);
+            break;
+        case OP_VEC_SIZE:
+            reg_vec(g, n->op, 1, false);
+            break;
+        case OP_VEC_GET:
+            reg_vec(g, n->op, 2, false);
+            break;
+        case OP_VEC_SET:
+            reg_vec(g, n->op, 3, true);
+            break;
+        case OP_VEC_PUSH:
+            reg_vec(g, n->op, 2, true);
+            break;
+        case OP_VEC_POP:
+            reg_vec(g, n->op, 1, true);
+            break;
+        case OP_LOAD8:
+            reg_vec(g, n->op, 2, false);
+            break;
+        case OP_STORE8:
+            reg_vec(g, n->op, 3, true);
+            break;
+        case OP_FADD:
+        case OP_FSUB:
+        case OP_FMUL:
+        case OP_FDIV:
+        case OP_FCMP:
+            reg_vec(g, n->op, 2, false);
+            break;
+        case OP_ITOF:
+        case OP_FTOI:
+            reg_vec(g, n->op, 1, false);
+            break;
+        case OP_LABEL_FNEND:
+            reg_op(g, n->op);
+            g->depth = 0;
+            g->reach = true;
+            break;
+        default:
+            break;
+    }
+}
+
+// Translates the node list into three-address register code: each
+// instruction names its frame slots, so reading a local or a constant costs
+// no instruction of its own and no operation touches GLOBAL_SP. Pushes are
+// deferred on a compile time operand stack and only land in their slot when
+// an instruction, a branch or a write that could change them needs it.
+void to_registers(union mem* mem, struct node* nodes, struct label* labels, struct debug* debug, const char* src) {
+    struct reg_gen* g = &reg_gen;
+    g->mem = mem;
+    g->iptr = mem + GLOB_SZ;
+    g->last = NULL;
+    g->labels = labels;
+    g->debug = debug;
+    g->src = src;
+    g->cur = NULL;
+    g->tok = NULL;
+    g->depth = 0;
+    g->reach = true;
+    for (int i = 0; i < (int)(COMP_SZ / sizeof(struct label)); i++)
+        g->lab_depth[i] = -1;
+    init_lines(debug);
+    pgo.site_size = 0;
+    for (struct node* n = nodes; n->op != OP_NULL; n++) {
+        if (n->token != NULL)
+            g->tok = n->token;
+        if (n->op == OP_LABEL) {
+            if (labels[n->val].token != NULL)
+                g->tok = labels[n->val].token;
+            reg_label(g, n->val);
+            continue;
+        }
+        reg_node(g, n);
+    }
+    mem[GLOBAL_IP].val = GLOB_SZ;
+    mem[GLOBAL_BP].val = g->iptr - mem;
+    mem[GLOBAL_SP].val = (g->iptr - mem) + STK_SZ;
+}
+
+void analyze_script(union mem* mem, struct node* nodes, struct token** locals, int* offsets, struct label* labels, int* lab_size, struct debug* debug, const char* src, struct stats* stats, struct config* cfg) {
+    analyze_primitive(nodes, labels, *lab_size);
+    stats->locals = analyze_push(nodes, locals, offsets);
+    stats->inlined = analyze_inline(nodes, labels, lab_size, cfg->inline_max);
+    if (!cfg->no_ssa)
+        stats->ssa_fns = analyze_ssa(nodes, labels, &stats->gvn, &stats->dce);
+    if (!cfg->no_loops)
+        analyze_loops(nodes, labels, &stats->hoisted, &stats->reduced);
+    stats->tail_calls = cfg->no_tail ? 0 : analyze_tail(nodes, labels);
+    stats->laid_out = analyze_layout(nodes, labels);
+    to_instructions(mem, nodes, labels, debug, src, false, cfg->compact && cfg->emit_c == NULL);
+}
+
+void link_instructions(union mem* mem, struct label* labels) {
+    for (union mem* inst = mem + GLOB_SZ; inst->op != OP_NULL; inst++) {
+        if (inst->op == OP_JMP || inst->op == OP_JZE || inst->op == OP_JNZ || inst->op == OP_CALL) {
+            inst++;
+            inst->val = labels[inst->val].inst_index;
+        } else if (inst->op == OP_TAILCALL) {
+            inst++;
+            inst->val = labels[inst->val].inst_index;
+            inst++;
+        } else if (inst->op == OP_PUSH_CONST || inst->op == OP_PUSH_VARADDR || inst->op == OP_SVCK) {
+            inst++;
+        } else if (inst->op == OP_FOR) {
+            inst += 3;
+        } else if (inst->op == OP_SWITCH || inst->op == OP_SEARCH) {
+            inst++;
+        } else if (inst->op == OP_CASE) {
+            inst += 2;
+            inst->val = labels[inst->val].inst_index;
+        }
+    }
+}
+
+int inst_size(enum op op) {
+    if (op == OP_PUSH_CONST || op == OP_PUSH_VARADDR || op == OP_JMP || op == OP_JZE || op == OP_JNZ || op == OP_CALL)
+        return 2;
+    if (op == OP_FOR)
+        return 4;
+    if (op == OP_SWITCH || op == OP_SEARCH || op == OP_SVCK)
+        return 2;
+    return op == OP_TAILCALL || op == OP_CASE ? 3 : 1;
+}
+
+// What the instruction at ip does, with the one-word pushes of a compact
+// image read as the PUSH_CONST or PUSH_VARADDR they stand for.
+enum op inst_op(union mem* mem, int ip) {
+    if (mem[ip].op >= OP_PUSH_SMALL)
+        return mem[ip].op >= OP_PUSH_LOCAL ? OP_PUSH_VARADDR : OP_PUSH_CONST;
+    return mem[ip].op;
+}
+
+int inst_val(union mem* mem, int ip) {
+    if (mem[ip].op >= OP_PUSH_LOCAL)
+        return mem[ip].val - OP_PUSH_LOCAL - STK_SZ;
+    if (mem[ip].op >= OP_PUSH_SMALL)
+        return mem[ip].val - OP_PUSH_SMALL - SMALL_SZ / 2;
+    return mem[ip + 1].val;
+}
+
+// The entry x selects among the n OP_CASE entries from at and the default
+// after them: OP_SWITCH indexes from the first key, OP_SEARCH halves the
+// sorted keys.
+int switch_entry(union mem* mem, enum op op, int at, int n, int x) {
+    if (op == OP_SWITCH) {
+        long i = (long)x - mem[at + 1].val;
+        return at + 3 * (i >= 0 && i < n ? i : n);
+    }
+    int lo = 0;
+    int hi = n;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        int key = mem[at + 3 * mid + 1].val;
+        if (key == x)
+            return at + 3 * mid;
+        if (key < x)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return at + 3 * n;
+}
+
+int reg_size(enum op op) {
+    switch (op) {
+        case OP_LABEL_FNEND:
+        case OP_PROFILE:
+            return 1;
+        case OP_JMP:
+        case OP_RETURN:
+        case OP_SVC:
+            return 2;
+        case OP_JZE:
+        case OP_JNZ:
+        case OP_SWITCH:
+        case OP_SEARCH:
+        case OP_CASE:
+        case OP_SVCK:
+        case OP_MOV:
+        case OP_MOVK:
+        case OP_LEA:
+        case OP_LOAD:
+        case OP_STORE:
+        case OP_VEC_INIT:
+        case OP_VEC_SIZE:
+        case OP_VEC_POP:
+        case OP_ITOF:
+        case OP_FTOI:
+            return 3;
+        case OP_VEC_SET:
+        case OP_STORE8:
+            return 5;
+        default:
+            return 4;
+    }
+}
+
+void link_registers(union mem* mem, struct label* labels) {
+    for (union mem* inst = mem + GLOB_SZ; inst->op != OP_NULL; inst += reg_size(inst->op)) {
+        if (inst->op == OP_JMP || inst->op == OP_CALL || inst->op == OP_TAILCALL)
+            inst[1].val = labels[inst[1].val].inst_index;
+        else if (inst->op == OP_JZE || inst->op == OP_JNZ || inst->op == OP_CASE)
+            inst[2].val = labels[inst[2].val].inst_index;
+    }
+}
+
+int packed_size(enum op op) {
+    if (op == OP_PUSH_CONST || op == OP_JMP || op == OP_JZE || op == OP_JNZ || op == OP_CALL || op == OP_SWITCH || op == OP_SEARCH || op == OP_SVCK)
+        return 5;
+    if (op == OP_PUSH_VARADDR)
+        return 3;
+    if (op == OP_FOR)
+        return 11;
+    if (op == OP_CASE)
+        return 9;
+    return op == OP_TAILCALL ? 7 : 1;
+}
+
+void pack_i16(unsigned char* p, int x) {
+    p[0] = x & 0xff;
+    p[1] = x >> 8 & 0xff;
+}
+
+void pack_i32(unsigned char* p, int x) {
+    pack_i16(p, x);
+    pack_i16(p + 2, x >> 16);
+}
+
+int unpack_i16(const unsigned char* p) {
+    return (short)(p[0] | p[1] << 8);
+}
+
+int unpack_i32(const unsigned char* p) {
+    return (int)(p[0] | p[1] << 8 | p[2] << 16 | (unsigned)p[3] << 24);
+}
+
+// switch_entry over packed entries, which take 9 bytes each.
+int packed_entry(const unsigned char* code, enum op op, int at, int n, int x) {
+    if (op == OP_SWITCH) {
+        long i = (long)x - unpack_i32(&code[at + 1]);
+        return at + 9 * (i >= 0 && i < n ? i : n);
+    }
+    int lo = 0;
+    int hi = n;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        int key = unpack_i32(&code[at + 9 * mid + 1]);
+        if (key == x)
+            return at + 9 * mid;
+        if (key < x)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return at + 9 * n;
+}
+
+// Whether the stack image can run from a packed code segment: it must fit,
+// and must not read a code address itself, through IP or the return address
+// in a frame, since those become byte offsets.
+bool can_pack(union mem* mem) {
+    int size = 1;
+    for (int ip = GLOB_SZ; mem[ip].op != OP_NULL; ip += inst_size(mem[ip].op)) {
+        if (mem[ip].op == OP_PUSH_VARADDR && mem[ip + 1].val == -3)
+            return false;
+        if (mem[ip].op == OP_PUSH_CONST && mem[ip + 1].val == GLOBAL_IP && mem[ip + 2].op == OP_GLOBAL_GET)
+            return false;
+        size += packed_size(mem[ip].op);
+    }
+    return size < MEM_SZ;
+}
+
+// Moves the stack image out of mem into packed.code: one byte per opcode,
+// 32-bit constants and targets, 16-bit frame offsets and argument counts.
+// Byte 0 stays OP_NULL so `1 = -1` still stops the program. mem is left
+// with the globals, and the stack starts right after them. The segment is
+// made read-only before it runs.
+int pack_image(union mem* mem) {
+    struct packed* p = &packed;
+    int end = mem[GLOBAL_BP].val;
+    int off = 1;
+    for (int ip = GLOB_SZ; ip <= end; ip += inst_size(mem[ip].op)) {
+        p->at[ip] = off;
+        p->word[off] = ip;
+        off += packed_size(mem[ip].op);
+    }
+    for (int ip = GLOB_SZ; ip < end; ip += inst_size(mem[ip].op)) {
+        unsigned char* c = &p->code[p->at[ip]];
+        c[0] = mem[ip].op;
+        if (mem[ip].op == OP_PUSH_CONST || mem[ip].op == OP_SWITCH || mem[ip].op == OP_SEARCH || mem[ip].op == OP_CASE || mem[ip].op == OP_SVCK)
+            pack_i32(c + 1, mem[ip + 1].val);
+        else if (mem[ip].op == OP_PUSH_VARADDR || mem[ip].op == OP_FOR)
+            pack_i16(c + 1, mem[ip + 1].val);
+        else if (packed_size(mem[ip].op) > 1)
+            pack_i32(c + 1, p->at[mem[ip + 1].val]);
+        if (mem[ip].op == OP_TAILCALL)
+            pack_i16(c + 5, mem[ip + 2].val);
+        if (mem[ip].op == OP_FOR) {
+            pack_i32(c + 3, mem[ip + 2].val);
+            pack_i32(c + 7, p->at[mem[ip + 3].val]);
+        }
+        if (mem[ip].op == OP_CASE)
+            pack_i32(c + 5, p->at[mem[ip + 2].val]);
+    }
+    p->size = p->at[end] + 1;
+    for (int i = GLOB_SZ; i < end; i++)
+        mem[i].val = 0;
+    mem[GLOBAL_IP].val = p->at[GLOB_SZ];
+    mem[GLOBAL_BP].val = GLOB_SZ;
+    mem[GLOBAL_SP].val = GLOB_SZ + STK_SZ;
+    mprotect(p->code, MEM_SZ, PROT_READ);
+    return p->size;
+}
+
+void out_push(char* buf, int* size, char ch) {
+    buf[(*size)++] = ch;
+}
+
+void out_str(char* buf, int* size, const char* str) {
+    for (; *str != '\0'; str++)
+        out_push(buf, size, *str);
+}
+
+void out_int(char* buf, int* size, long x) {
+    long m = 1000000000000000000L;
+    if (x == 0) {
+        out_push(buf, size, '0');
+        return;
+    }
+    if (x < 0) {
+        out_push(buf, size, '-');
+        x = -x;
+    }
+    while (x / m == 0)
+        m /= 10;
+    while (m != 0) {
+        char ch = (x / m % 10) + '0';
+        out_push(buf, size, ch);
+        m /= 10;
+    }
+}
+
+void out_flush(int fd, char* buf, int* size) {
+    write(fd, buf, *size);
+    *size = 0;
+}
+
+void out_memory(union mem* mem, char* buf) {
+    int fd = open("Scratch.txt", O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    int size = 0;
+    for (int i = 1; i < DUMP_SZ; i++) {
+        out_int(buf, &size, mem[i].val);
+        out_push(buf, &size, '\n');
+    }
+    write(fd, buf, size);
+    close(fd);
+}
+
+void init_debug(struct debug* debug, struct label* labels, int lab_size) {
+    debug->func_size = 0;
+    for (int i = 0; i < lab_size && debug->func_size < FN_SZ; i++) {
+        if (labels[i].token == NULL)
+            continue;
+        struct func* f = &debug->funcs[debug->func_size++];
+        int n = labels[i].token->size < NAME_SZ - 1 ? labels[i].token->size : NAME_SZ - 1;
+        for (int j = 0; j < n; j++)
+            f->name[j] = labels[i].token->data[j];
+        f->name[n] = '\0';
+        f->inst_index = labels[i].inst_index;
+    }
+}
+
+int find_func(struct debug* debug, int ip) {
+    int lo = 0;
+    int hi = debug->func_size;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (debug->funcs[mid].inst_index <= ip)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo - 1;
+}
+
+const char* func_name(struct debug* debug, int ip) {
+    int i = find_func(debug, ip);
+    return i < 0 ? "(top)" : debug->funcs[i].name;
+}
+
+void out_loc(char* buf, int* size, struct debug* debug, int ip) {
+    struct line l;
+    out_str(buf, size, func_name(debug, ip));
+    if (find_line(debug, ip, &l)) {
+        out_push(buf, size, ':');
+        out_int(buf, size, l.line);
+    }
+}
+
+void out_token(char* buf, int* size, struct token* token) {
+    for (int i = 0; i < token->size; i++)
+        out_push(buf, size, token->data[i]);
+}
+
+void inline_report(struct label* labels, const char* src, char* buf) {
+    const char* cur = NULL;
+    struct line pos;
+    int size = 0;
+    for (int i = 0; i < inliner.site_size; i++) {
+        struct inline_site* site = &inliner.sites[i];
+        src_pos(src, &cur, site->token->data, &pos);
+        out_str(buf, &size, "inline ");
+        out_token(buf, &size, labels[site->callee].token);
+        out_str(buf, &size, " into ");
+        if (site->caller == -1)
+            out_str(buf, &size, "(top)");
+        else
+            out_token(buf, &size, labels[site->caller].token);
+        out_push(buf, &size, ':');
+        out_int(buf, &size, pos.line);
+        out_push(buf, &size, '\n');
+        if (size > COMP_SZ - BUF_SZ)
+            out_flush(STDERR_FILENO, buf, &size);
+    }
+    out_flush(STDERR_FILENO, buf, &size);
+}
+
+int pgo_word(const char** p, char* dst) {
+    int n = 0;
+    while (**p == ' ' || **p == '\n')
+        (*p)++;
+    for (; **p != '\0' && **p != ' ' && **p != '\n'; (*p)++) {
+        if (n < NAME_SZ - 1)
+            dst[n++] = **p;
+    }
+    dst[n] = '\0';
+    return n;
+}
+
+long pgo_num(const char** p) {
+    long x = 0;
+    while (**p == ' ')
+        (*p)++;
+    bool neg = **p == '-';
+    if (neg)
+        (*p)++;
+    for (; **p >= '0' && **p <= '9'; (*p)++)
+        x = x * 10 + **p - '0';
+    return neg ? -x : x;
+}
+
+// Reads a profile written by pgo_write. Counts for the same key add up, so
+// profiles of several runs can simply be concatenated.
+void pgo_read(const char* path, char* buf) {
+    char kind[NAME_SZ];
+    char name[NAME_SZ];
+    const char* p = buf;
+    read_file(path, buf);
+    pgo.calls = 0;
+    while (pgo_word(&p, kind) != 0) {
+        bool call = str_eq(kind, "call");
+        pgo_word(&p, name);
+        int off = pgo_num(&p);
+        int ordinal = call ? 0 : pgo_num(&p);
+        struct pgo_ent* e = pgo_find(call ? PGO_CALL : PGO_LABEL, name, off, ordinal, true);
+        for (int i = 0; i < (call ? 1 : PGO_COUNTS); i++) {
+            long x = pgo_num(&p);
+            if (e != NULL)
+                e->n[i] += x;
+            if (call)
+                pgo.calls += x;
+        }
+    }
+    pgo.loaded = true;
+}
+
+// Folds the per instruction counts into the entries of their sites and writes
+// one line per entry: call name offset count, or label name offset ordinal
+// followed by taken and fallen through counts of forward and then backward
+// branches to it.
+void pgo_write(union mem* mem, const char* path, char* buf) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    int size = 0;
+    for (int i = 0; i < pgo.site_size; i++) {
+        struct pgo_site* site = &pgo.sites[i];
+        if (site->ent == -1)
+            continue;
+        struct pgo_ent* e = &pgo.ents[site->ent];
+        long taken = pgo.taken[site->ip];
+        long fall = pgo.count[site->ip] - taken;
+        bool back = site->kind == PGO_LABEL && mem[site->ip + site->word].val <= site->ip;
+        e->n[back ? PGO_BACK : PGO_TAKEN] += taken;
+        e->n[back ? PGO_BACK_FALL : PGO_FALL] += fall;
+    }
+    for (int i = 0; i < PGO_ENTS; i++) {
+        struct pgo_ent* e = &pgo.ents[i];
+        if (!e->used)
+            continue;
+        out_str(buf, &size, e->kind == PGO_CALL ? "call " : "label ");
+        out_str(buf, &size, e->name);
+        out_push(buf, &size, ' ');
+        out_int(buf, &size, e->off);
+        if (e->kind == PGO_LABEL) {
+            out_push(buf, &size, ' ');
+            out_int(buf, &size, e->ordinal);
+        }
+        for (int j = 0; j < (e->kind == PGO_CALL ? 1 : PGO_COUNTS); j++) {
+            out_push(buf, &size, ' ');
+            out_int(buf, &size, e->n[j]);
+        }
+        out_push(buf, &size, '\n');
+        if (size > COMP_SZ - BUF_SZ)
+            out_flush(fd, buf, &size);
+    }
+    out_flush(fd, buf, &size);
+    close(fd);
+}
+
+void dump_lines(struct debug* debug, char* buf) {
+    int size = 0;
+    int pos = 0;
+    struct line l = {0, 0, 0};
+    while (pos < debug->line_size) {
+        l.inst_index += line_pop_uint(debug, &pos);
+        unsigned zl = line_pop_uint(debug, &pos);
+        l.line += (zl & 1) ? -(int)((zl + 1) >> 1) : (int)(zl >> 1);
+        l.col = line_pop_uint(debug, &pos);
+        out_int(buf, &size, l.inst_index);
+        out_push(buf, &size, ' ');
+        out_int(buf, &size, l.line);
+        out_push(buf, &size, ':');
+        out_int(buf, &size, l.col);
+        out_push(buf, &size, ' ');
+        out_str(buf, &size, func_name(debug, l.inst_index));
+        out_push(buf, &size, '\n');
+        if (size > COMP_SZ - BUF_SZ)
+            out_flush(STDERR_FILENO, buf, &size);
+    }
+    out_flush(STDERR_FILENO, buf, &size);
+}
+
+void perf_open(void) {
+    static const unsigned type[CNT_SZ] = {
+        PERF_TYPE_HARDWARE,
+        PERF_TYPE_HARDWARE,
+        PERF_TYPE_HARDWARE,
+        PERF_TYPE_HW_CACHE,
+        PERF_TYPE_HW_CACHE,
+    };
+    static const unsigned long long config[CNT_SZ] = {
+        PERF_COUNT_HW_CPU_CYCLES,
+        PERF_COUNT_HW_INSTRUCTIONS,
+        PERF_COUNT_HW_BRANCH_MISSES,
+        PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16),
+        PERF_COUNT_HW_CACHE_LL | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16),
+    };
+    perf.on = true;
+    for (int i = 0; i < CNT_SZ; i++) {
+        struct perf_event_attr attr = {.type = type[i], .size = sizeof(attr), .config = config[i], .exclude_kernel = 1, .exclude_hv = 1};
+        perf.fd[i] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+}
+
+void perf_read(long* out) {
+    for (int i = 0; i < CNT_SZ; i++) {
+        out[i] = -1;
+        if (perf.fd[i] >= 0 && read(perf.fd[i], &out[i], sizeof(long)) != sizeof(long))
+            out[i] = -1;
+    }
+}
+
+void out_counts(char* buf, int* size, long* counts) {
+    for (int i = 0; i < CNT_SZ; i++) {
+        out_push(buf, size, ' ');
+        out_int(buf, size, perf.fd[i] >= 0 ? counts[i] : -1);
+    }
+}
+
+void prof_handler(int sig) {
+    (void)sig;
+    union mem* mem = prof.mem;
+    struct prof_stack s = {.count = 1, .size = 1};
+    int bp = mem[GLOBAL_BP].val;
+    unsigned hash = s.ip[0] = mem[GLOBAL_IP].val;
+    while (s.size < PROF_DEPTH && bp > prof.base && bp < arena.words) {
+        s.ip[s.size] = mem[bp - 3].val - 1;
+        hash = hash * 31 + s.ip[s.size++];
+        if (mem[bp - 1].val >= bp)
+            break;
+        bp = mem[bp - 1].val;
+    }
+    s.cut = bp > prof.base && s.size == PROF_DEPTH;
+    prof.total++;
+    if (perf.on) {
+        long now[CNT_SZ];
+        int f = find_func(prof.debug, s.ip[0]) + 1;
+        perf_read(now);
+        for (int i = 0; i < CNT_SZ; i++) {
+            prof.func_counts[f][i] += now[i] - prof.last[i];
+            prof.last[i] = now[i];
+        }
+        prof.func_samples[f]++;
+    }
+    for (int i = 0; i < PROF_STACKS; i++) {
+        struct prof_stack* t = &prof.stacks[(hash + i) % PROF_STACKS];
+        if (t->count == 0) {
+            *t = s;
+            return;
+        }
+        if (t->size != s.size || t->cut != s.cut)
+            continue;
+        int j = 0;
+        while (j < s.size && t->ip[j] == s.ip[j])
+            j++;
+        if (j == s.size) {
+            t->count++;
+            return;
+        }
+    }
+    prof.dropped++;
+}
+
+void prof_start(union mem* mem, struct debug* debug) {
+    struct sigaction sa = {.sa_handler = prof_handler, .sa_flags = SA_RESTART};
+    struct itimerval it = {.it_interval = {0, PROF_US}, .it_value = {0, PROF_US}};
+    prof.mem = mem;
+    prof.debug = debug;
+    prof.base = mem[GLOBAL_BP].val;
+    if (perf.on)
+        perf_read(prof.last);
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGPROF, &sa, NULL);
+    setitimer(ITIMER_PROF, &it, NULL);
+}
+
+void prof_stop(void) {
+    struct itimerval it = {0};
+    setitimer(ITIMER_PROF, &it, NULL);
+    signal(SIGPROF, SIG_IGN);
+}
+
+void prof_report(struct debug* debug, char* buf) {
+    int size = 0;
+    out_str(buf, &size, "# samples ");
+    out_int(buf, &size, prof.total);
+    out_str(buf, &size, " dropped ");
+    out_int(buf, &size, prof.dropped);
+    out_push(buf, &size, '\n');
+    for (int i = 0; i < PROF_STACKS; i++) {
+        struct prof_stack* s = &prof.stacks[i];
+        if (s->count == 0)
+            continue;
+        if (s->cut)
+            out_str(buf, &size, "...;");
+        for (int j = s->size - 1; j >= 0; j--) {
+            out_loc(buf, &size, debug, s->ip[j]);
+            out_push(buf, &size, j == 0 ? ' ' : ';');
+        }
+        out_int(buf, &size, s->count);
+        out_push(buf, &size, '\n');
+        if (size > COMP_SZ - BUF_SZ * PROF_DEPTH)
+            out_flush(STDERR_FILENO, buf, &size);
+    }
+    if (perf.on) {
+        out_str(buf, &size, "# fn samples cycles instructions branch_misses l1d_misses llc_misses\n");
+        for (int i = 0; i <= debug->func_size; i++) {
+            if (prof.func_samples[i] == 0)
+                continue;
+            out_str(buf, &size, i == 0 ? "(top)" : debug->funcs[i - 1].name);
+            out_push(buf, &size, ' ');
+            out_int(buf, &size, prof.func_samples[i]);
+            out_counts(buf, &size, prof.func_counts[i]);
+            out_push(buf, &size, '\n');
+            if (size > COMP_SZ - BUF_SZ)
+                out_flush(STDERR_FILENO, buf, &size);
+        }
+    }
+    out_flush(STDERR_FILENO, buf, &size);
+}
+
+// Reserves the VM's memory as one mapping of the given size in words, rounded
+// up to whole pages, between two inaccessible guard pages. The kernel commits
+// a page only when the program first writes it, so a small script pays for
+// what it touches and a large one can grow up to the limit set with --mem.
+// With huge set the mapping asks for transparent huge pages.
+union mem* arena_map(long words, bool huge) {
+    long pages = (words + PAGE_WORDS - 1) / PAGE_WORDS;
+    char* p = mmap(NULL, (pages + 2) * PAGE_SZ, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (p == MAP_FAILED)
+        return NULL;
+    mprotect(p, PAGE_SZ, PROT_NONE);
+    mprotect(p + (pages + 1) * PAGE_SZ, PAGE_SZ, PROT_NONE);
+    if (huge)
+        madvise(p + PAGE_SZ, pages * PAGE_SZ, MADV_HUGEPAGE);
+    arena = (struct arena){(union mem*)(p + PAGE_SZ), pages * PAGE_WORDS};
+    heap.cls = mmap(NULL, arena.words, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (heap.cls == MAP_FAILED)
+        return NULL;
+    return arena.base;
+}
+
+// Pages of the VM's memory the kernel has committed so far, or -1 when it
+// will not say.
+long arena_touched(void) {
+    static unsigned char vec[PAGE_SZ];
+    long bytes = arena.words * sizeof(union mem);
+    long pages = 0;
+    for (long off = 0; off < bytes; off += (long)PAGE_SZ * PAGE_SZ) {
+        long len = bytes - off < (long)PAGE_SZ * PAGE_SZ ? bytes - off : (long)PAGE_SZ * PAGE_SZ;
+        if (mincore((char*)arena.base + off, len, vec) != 0)
+            return -1;
+        for (long i = 0; i < (len + PAGE_SZ - 1) / PAGE_SZ; i++)
+            pages += vec[i] & 1;
+    }
+    return pages;
+}
+
+// Moves the stack of a loaded image to its own pages so that it cannot run
+// into the code, and gives the upper half of memory to the heap. The pages
+// holding only code become read-only and the ones after them and below the
+// heap inaccessible, so a store into the code or below the first frame
+// faults, as does a push past the top of the stack. The first page stays
+// writable as it holds the globals.
+void guard_image(union mem* mem) {
+    int end = mem[GLOBAL_BP].val;
+    int lo = (end + PAGE_WORDS) / PAGE_WORDS * PAGE_WORDS;
+    if (lo > PAGE_WORDS)
+        mprotect(mem + PAGE_WORDS, (lo - PAGE_WORDS) * sizeof(union mem), PROT_READ);
+    mprotect(mem + lo, PAGE_SZ, PROT_NONE);
+    heap.lo = heap.top = arena.words / 2 / PAGE_WORDS * PAGE_WORDS;
+    mprotect(mem + heap.lo - PAGE_WORDS, PAGE_SZ, PROT_NONE);
+    guard.code_hi = end + 1;
+    guard.stack = lo + PAGE_WORDS;
+    mem[GLOBAL_BP].val = guard.stack;
+    mem[GLOBAL_SP].val = guard.stack + STK_SZ;
+}
+
+// Turns a fault the running script causes into the VM error for where it
+// landed, and leaves the interpreter through guard_run.
+void guard_handler(int sig, siginfo_t* info, void* ctx) {
+    (void)sig;
+    (void)ctx;
+    long a = ((long)info->si_addr - (long)arena.base) / (long)sizeof(union mem);
+    if (a >= heap.lo - PAGE_WORDS && a < heap.lo)
+        guard.err = ERR_OVERFLOW;
+    else if (a >= PAGE_WORDS && a < guard.code_hi)
+        guard.err = ERR_CODE;
+    else if (a >= guard.code_hi && a < guard.stack)
+        guard.err = ERR_STACK;
+    else
+        guard.err = ERR_ADDR;
+    siglongjmp(guard.env, 1);
+}
+
+// The svc 3 allocator: a segregated fit over the heap, with a free list for
+// each power of two. The word before a block holds its size class while it
+// is live and the class negated once freed, when the word after links it to
+// the next free block of its class. The link is in script memory, so a link
+// heap.cls does not show as a free block of the class ends the list.
+// Returns 0 when the heap is full.
+int heap_alloc(union mem* mem, int size) {
+    int c = 1;
+    int p;
+    if (size < 0)
+        return 0;
+    while ((1L << c) < size + 1L)
+        c++;
+    if (c >= HEAP_CLASSES)
+        return 0;
+    if (heap.free[c] != 0) {
+        p = heap.free[c];
+        int next = mem[p].val;
+        heap.free[c] = next > heap.lo && next < heap.top && heap.cls[next] == -c ? next : 0;
+    } else {
+        if (heap.top + (1L << c) > arena.words)
+            return 0;
+        p = heap.top + 1;
+        heap.top += 1 << c;
+    }
+    mem[p - 1].val = c;
+    heap.cls[p] = c;
+    heap.allocs++;
+    heap.live += 1L << c;
+    if (heap.live > heap.peak)
+        heap.peak = heap.live;
+    return p;
+}
+
+// The svc 4 counterpart, which returns -1 for anything but the start of a
+// live block, so an interior pointer or a second free changes nothing.
+int heap_free(union mem* mem, int p) {
+    if (p <= heap.lo || p >= heap.top || heap.cls[p] <= 0)
+        return -1;
+    int c = heap.cls[p];
+    heap.cls[p] = -c;
+    mem[p - 1].val = -c;
+    mem[p].val = heap.free[c];
+    heap.free[c] = p;
+    heap.frees++;
+    heap.live -= 1L << c;
+    return 0;
+}
+
+// The services that work on VM memory. 3 and 4 allocate and free heap
+// blocks; 5 allocates a byte buffer of x bytes, a word holding its length
+// followed by the bytes packed four to a word, for load8 and store8; 6 and
+// 7 fill the byte buffer at x from stdin and write it to stdout, returning
+// how many bytes moved, or -1 for a buffer that is not inside the heap. Any
+// other service leaves x as it is.
+int svc_mem(union mem* mem, int io, int x) {
+    int p;
+    if ((io == 6 || io == 7) && (x <= heap.lo || x >= heap.top || mem[x].val < 0 || x + 1 + (mem[x].val + 3L) / 4 > heap.top))
+        return -1;
+    switch (io) {
+        case 3:
+            return heap_alloc(mem, x);
+        case 4:
+            return heap_free(mem, x);
+        case 5:
+            p = x < 0 ? 0 : heap_alloc(mem, (int)((x + 3L) / 4 + 1));
+            if (p != 0)
+                mem[p].val = x;
+            return p;
+        case 6:
+            return read(STDIN_FILENO, &mem[x + 1], mem[x].val);
+        case 7:
+            return write(STDOUT_FILENO, &mem[x + 1], mem[x].val);
+        default:
+            return x;
+    }
+}
+
+// Runs service io on x the way OP_SVC does for the service in the IO global,
+// for OP_SVCK, which carries io in the instruction.
+int svc_io(union mem* mem, int io, int x) {
+    if (io == 0)
+        read(STDIN_FILENO, &x, 1);
+    else if (io == 1)
+        write(STDOUT_FILENO, &x, 1);
+    else if (io == 2)
+        usleep(x * 1000);
+    else
+        x = svc_mem(mem, io, x);
+    return x;
+}
+
+// Marks where each instruction of the image starts and returns where it ends.
+// For a checked image only the OP_CHECK words count, as those are the only
+// places a jump or return may land.
+int verify_decode(union mem* mem, bool checked) {
+    struct verifier* v = &verifier;
+    int ip = GLOB_SZ;
+    while (mem[ip].op != OP_NULL) {
+        int size = inst_size(mem[ip].op);
+        for (int i = 0; i < size; i++) {
+            v->start[ip + i] = i == 0 && (!checked || mem[ip].op == OP_CHECK);
+            v->depth[ip + i] = -1;
+        }
+        ip += size;
+    }
+    v->end = ip;
+    return ip;
+}
+
+bool verify_fail(struct verifier* v, const char* why) {
+    v->why = why;
+    return false;
+}
+
+// Arguments taken by the function entered at ip, read back from the prologue
+// parse_fn puts there, or -1 when ip is not the entry of a function.
+int verify_args(union mem* mem, struct debug* debug, int ip) {
+    static const enum op prologue[] = {OP_PUSH_VARADDR, OP_PUSH_VARADDR, OP_GLOBAL_GET, OP_PUSH_CONST, OP_SUB, OP_GLOBAL_SET};
+    int vals[6];
+    int f = find_func(debug, ip);
+    int at = ip;
+    if (f < 0 || debug->funcs[f].inst_index != ip)
+        return -1;
+    for (int i = 0; i < 6; i++) {
+        if (inst_op(mem, at) != prologue[i])
+            return -1;
+        vals[i] = inst_val(mem, at);
+        at += inst_size(mem[at].op);
+    }
+    return vals[0] == -2 && vals[1] == -2 && vals[3] >= 0 ? vals[3] : -1;
+}
+
+bool verify_edge(struct verifier* v, int lo, int hi, int ip, int depth) {
+    if (ip < lo || ip >= hi || !v->start[ip])
+        return verify_fail(v, "jump out of its function");
+    if (v->depth[ip] == -1) {
+        v->depth[ip] = depth;
+        v->work[v->work_size++] = ip;
+        return true;
+    }
+    return v->depth[ip] == depth || verify_fail(v, "inconsistent stack depth");
+}
+
+// Where the instruction ending just before ip starts, when it pushes a
+// constant, which goes to x. -1 otherwise.
+int verify_const(union mem* mem, int ip, int* x) {
+    for (int at = ip - 1; at >= ip - 2 && at >= GLOB_SZ; at--) {
+        if (verifier.start[at] && at + inst_size(mem[at].op) == ip && inst_op(mem, at) == OP_PUSH_CONST) {
+            *x = inst_val(mem, at);
+            return at;
+        }
+    }
+    return -1;
+}
+
+// Walks every path from lo with the stack depth each instruction sees. Code
+// between lo and hi must only jump within itself, reach each instruction at
+// one depth, pop no more than it pushed, call only function entries with the
+// arguments they take, and leave through a return, a tail call or the
+// `1 = -1` store that stops the program. Top-level code may also run off the
+// end of the image.
+bool verify_region(struct verifier* v, union mem* mem, struct debug* debug, int lo, int hi) {
+    v->work_size = 0;
+    v->depth[lo] = 0;
+    v->work[v->work_size++] = lo;
+    while (v->work_size != 0) {
+        int ip = v->work[--v->work_size];
+        int depth = v->depth[ip];
+        union mem* inst = &mem[ip];
+        struct node n = {inst_op(mem, ip), NULL, 0};
+        int next = ip + inst_size(inst->op);
+        int pops;
+        int effect;
+        int addr;
+        int x;
+        v->at = ip;
+        if ((n.op > OP_TAILCALL && n.op < OP_LOAD8 && n.op != OP_JNZ && n.op != OP_PROFILE) || n.op == OP_LABEL || n.op == OP_CASE)
+            return verify_fail(v, "invalid opcode");
+        if (inst->op != OP_CALL && inst->op != OP_TAILCALL) {
+            pops = inst->op == OP_RETURN ? 0 : node_pops(&n, NULL);
+            effect = node_effect(&n, NULL);
+        } else {
+            pops = verify_args(mem, debug, inst[1].val);
+            effect = 1 - pops;
+            if (pops < 0)
+                return verify_fail(v, "call to a non-function");
+            if (inst->op == OP_TAILCALL && inst[2].val != pops)
+                return verify_fail(v, "tail call with the wrong argument count");
+        }
+        if (depth < pops)
+            return verify_fail(v, "stack underflow");
+        if (depth + effect > VERIFY_DEPTH)
+            return verify_fail(v, "stack too deep");
+        int at = inst->op == OP_GLOBAL_SET ? verify_const(mem, ip, &x) : -1;
+        if (at != -1 && verify_const(mem, at, &addr) != -1 && is_frame_reg(addr)) {
+            if (addr == GLOBAL_IP && x == -1)
+                continue;
+            return verify_fail(v, "store to a frame register");
+        }
+        if (inst->op == OP_LABEL_FNEND)
+            return verify_fail(v, "falls off the end of a function");
+        if (inst->op == OP_RETURN)
+            continue;
+        if (inst->op == OP_JMP || inst->op == OP_JZE || inst->op == OP_JNZ) {
+            if (!verify_edge(v, lo, hi, inst[1].val, depth + effect))
+                return false;
+            if (inst->op == OP_JMP)
+                continue;
+        }
+        if (inst->op == OP_FOR && !verify_edge(v, lo, hi, inst[3].val, depth))
+            return false;
+        if (inst->op == OP_SWITCH || inst->op == OP_SEARCH) {
+            for (int k = 0; k <= inst[1].val; k++) {
+                int at = ip + 2 + 3 * k;
+                if (at >= hi || mem[at].op != OP_CASE)
+                    return verify_fail(v, "bad jump table");
+                if (!verify_edge(v, lo, hi, mem[at + 2].val, depth + effect))
+                    return false;
+            }
+            continue;
+        }
+        if (inst->op == OP_TAILCALL)
+            continue;
+        if (next >= hi) {
+            if (mem[next].op != OP_NULL)
+                return verify_fail(v, "runs into a function");
+            continue;
+        }
+        if (!verify_edge(v, lo, hi, next, depth + effect))
+            return false;
+    }
+    return true;
+}
+
+// Proves the top-level code and each function safe to run without the checks
+// OP_CHECK makes. On failure verifier.why and verifier.at say what and where.
+bool verify_script(union mem* mem, struct debug* debug) {
+    struct verifier* v = &verifier;
+    int end = verify_decode(mem, false);
+    int hi = debug->func_size == 0 ? end : debug->funcs[0].inst_index;
+    v->why = NULL;
+    v->at = GLOB_SZ;
+    if (hi == GLOB_SZ && end != GLOB_SZ)
+        return verify_fail(v, "runs into a function");
+    if (hi != GLOB_SZ && !verify_region(v, mem, debug, GLOB_SZ, hi))
+        return false;
+    for (int i = 0; i < debug->func_size; i++) {
+        int lo = debug->funcs[i].inst_index;
+        hi = lo;
+        while (hi < end && mem[hi].op != OP_LABEL_FNEND)
+            hi += inst_size(mem[hi].op);
+        v->at = lo;
+        if (hi == end)
+            return verify_fail(v, "function without an end");
+        if (!verify_region(v, mem, debug, lo, hi + 1))
+            return false;
+    }
+    return true;
+}
+
+bool check_addr(long a) {
+    return a >= 0 && a < arena.words;
+}
+
+// Stores may go to the globals other than IP, SP and BP and to memory above
+// the image, never into the image itself.
+bool check_store(long a) {
+    return check_addr(a) && (a < GLOB_SZ ? a > GLOBAL_BP : a >= verifier.end);
+}
+
+bool check_target(long ip) {
+    return ip >= 0 && ip < verifier.end && verifier.start[ip];
+}
+
+// Runs as OP_CHECK, ahead of the instruction that follows it (skipping an
+// OP_PROFILE), and reports what that instruction would do wrong: touch a word
+// outside memory, store into the image or a frame register, divide by zero,
+// or send IP anywhere but the start of an instruction.
+enum err check_inst(union mem* mem) {
+    int ip = mem[GLOBAL_IP].val + 1;
+    long sp = mem[GLOBAL_SP].val;
+    long bp = mem[GLOBAL_BP].val;
+    if (mem[ip].op == OP_PROFILE)
+        ip++;
+    union mem* inst = &mem[ip];
+    struct node n = {inst_op(mem, ip), NULL, 0};
+    int pops = inst->op == OP_CALL ? 0 : inst->op == OP_TAILCALL ? inst[2].val : node_pops(&n, NULL);
+    long a1;
+    long a2;
+    long a3;
+    if (sp - pops < GLOB_SZ || sp + 1 >= heap.lo - PAGE_WORDS)
+        return ERR_STACK;
+    switch (inst->op) {
+        case OP_GLOBAL_GET:
+            return check_addr(mem[sp - 1].val) ? ERR_NONE : ERR_ADDR;
+        case OP_GLOBAL_SET:
+            a1 = mem[sp - 2].val;
+            if (a1 == GLOBAL_IP)
+                return mem[sp - 1].val == -1 || check_target(mem[sp - 1].val + 1L) ? ERR_NONE : ERR_JUMP;
+            return a1 == GLOBAL_SP || a1 == GLOBAL_BP || check_store(a1) ? ERR_NONE : ERR_ADDR;
+        case OP_CALL:
+            if (sp + STK_SZ >= heap.lo - PAGE_WORDS)
+                return ERR_STACK;
+            return check_target(inst[1].val) ? ERR_NONE : ERR_JUMP;
+        case OP_RETURN:
+            if (bp < GLOB_SZ + 3 || bp > arena.words)
+                return ERR_STACK;
+            a1 = mem[bp - 2].val;
+            if (a1 < GLOB_SZ || a1 + 1 >= arena.words || !check_store(a1))
+                return ERR_STACK;
+            return check_target(mem[bp - 3].val + 1L) ? ERR_NONE : ERR_JUMP;
+        case OP_TAILCALL:
+            if (bp < GLOB_SZ + 3 || bp > arena.words)
+                return ERR_STACK;
+            a1 = mem[bp - 2].val;
+            if (!check_store(a1) || a1 + pops + STK_SZ >= heap.lo - PAGE_WORDS)
+                return ERR_STACK;
+            return check_target(inst[1].val) ? ERR_NONE : ERR_JUMP;
+        case OP_JMP:
+        case OP_JZE:
+        case OP_JNZ:
+            return check_target(inst[1].val) ? ERR_NONE : ERR_JUMP;
+        case OP_FOR:
+            if (!check_store(bp + inst[1].val))
+                return ERR_ADDR;
+            return check_target(inst[3].val) ? ERR_NONE : ERR_JUMP;
+        case OP_SWITCH:
+        case OP_SEARCH:
+            a1 = switch_entry(mem, inst->op, ip + 2, inst[1].val, mem[sp - 1].val);
+            return check_target(mem[a1 + 2].val) ? ERR_NONE : ERR_JUMP;
+        case OP_DIV:
+        case OP_MOD:
+            a1 = mem[sp - 2].val;
+            a2 = mem[sp - 1].val;
+            return a2 == 0 || (a2 == -1 && a1 == INT_MIN) ? ERR_DIV : ERR_NONE;
+        case OP_VEC_INIT:
+            return check_store(mem[sp - 1].val) ? ERR_NONE : ERR_ADDR;
+        case OP_VEC_SIZE:
+            return check_addr(mem[sp - 1].val) ? ERR_NONE : ERR_ADDR;
+        case OP_VEC_GET:
+            a1 = mem[sp - 2].val;
+            return check_addr(a1) && check_addr(a1 + mem[sp - 1].val + 1) ? ERR_NONE : ERR_ADDR;
+        case OP_VEC_SET:
+            a1 = mem[sp - 3].val;
+            return check_addr(a1) && check_store(a1 + mem[sp - 2].val + 1) ? ERR_NONE : ERR_ADDR;
+        case OP_VEC_PUSH:
+            a1 = mem[sp - 2].val;
+            return check_store(a1) && check_store(a1 + mem[a1].val + 1) ? ERR_NONE : ERR_ADDR;
+        case OP_VEC_POP:
+            a1 = mem[sp - 1].val;
+            return check_store(a1) && check_addr(a1 + mem[a1].val) ? ERR_NONE : ERR_ADDR;
+        case OP_LOAD8:
+            a1 = mem[sp - 2].val;
+            return check_addr(a1) && check_addr(a1 + (mem[sp - 1].val >> 2) + 1) ? ERR_NONE : ERR_ADDR;
+        case OP_STORE8:
+            a1 = mem[sp - 3].val;
+            return check_addr(a1) && check_store(a1 + (mem[sp - 2].val >> 2) + 1) ? ERR_NONE : ERR_ADDR;
+        case OP_SVC:
+        case OP_SVCK:
+            a3 = inst->op == OP_SVC ? mem[GLOBAL_IO].val : inst[1].val;
+            if (a3 != 6 && a3 != 7)
+                return ERR_NONE;
+            a1 = mem[sp - 1].val;
+            if (!check_addr(a1))
+                return ERR_ADDR;
+            if (mem[a1].val <= 0)
+                return ERR_NONE;
+            a2 = a1 + (mem[a1].val + 3L) / 4;
+            if (a3 == 6)
+                return check_store(a1 + 1) && check_store(a2) && (a1 + 1 >= GLOB_SZ || a2 < GLOB_SZ) ? ERR_NONE : ERR_ADDR;
+            return check_addr(a2) ? ERR_NONE : ERR_ADDR;
+        default:
+            return ERR_NONE;
+    }
+}
+
+enum err run_script(union mem* mem) {
+    int a1;
+    int a2;
+    int a3;
+    int a4;
+    while (mem[mem[GLOBAL_IP].val].op != OP_NULL) {
+        switch (BENCH_STEP(mem[mem[GLOBAL_IP].val].op)) {
+            case OP_NULL:
+                break;
+            case OP_NOP:
+                break;
+            case OP_PUSH_CONST:
+                (mem[GLOBAL_IP].val)++;
+                mem[(mem[GLOBAL_SP].val)++].val = mem[mem[GLOBAL_IP].val].val;
+                break;
+            case OP_PUSH_VARADDR:
+                (mem[GLOBAL_IP].val)++;
+                mem[(mem[GLOBAL_SP].val)++].val = mem[GLOBAL_BP].val + mem[mem[GLOBAL_IP].val].val;
+                break;
+            case OP_TEST01:
+                break;
+            case OP_TEST02:
+                break;
+            case OP_TEST03:
+                break;
+            case OP_GLOBAL_GET:
+                mem[mem[GLOBAL_SP].val - 1].val = mem[mem[mem[GLOBAL_SP].val - 1].val].val;
+                break;
+            case OP_GLOBAL_SET:
+                mem[mem[mem[GLOBAL_SP].val - 2].val].val = mem[mem[GLOBAL_SP].val - 1].val;
+                mem[GLOBAL_SP].val -= 2;
+                break;
+            case OP_CALL:
+                mem[(mem[GLOBAL_SP].val) + 0].val = mem[GLOBAL_IP].val + 1;
+                mem[(mem[GLOBAL_SP].val) + 1].val = mem[GLOBAL_SP].val;
+                mem[(mem[GLOBAL_SP].val) + 2].val = mem[GLOBAL_BP].val;
+                mem[GLOBAL_IP].val = mem[mem[GLOBAL_IP].val + 1].val - 1;
+                mem[GLOBAL_BP].val = mem[GLOBAL_SP].val + 3;
+                mem[GLOBAL_SP].val += STK_SZ;
+                break;
+            case OP_RETURN:
+                a1 = mem[mem[GLOBAL_SP].val - 1].val;
+                mem[GLOBAL_IP].val = mem[mem[GLOBAL_BP].val - 3].val;
+                mem[GLOBAL_SP].val = mem[mem[GLOBAL_BP].val - 2].val;
+                mem[GLOBAL_BP].val = mem[mem[GLOBAL_BP].val - 1].val;
+                mem[mem[GLOBAL_SP].val].val = a1;
+                mem[GLOBAL_SP].val++;
+                break;
+            case OP_JMP:
+                mem[GLOBAL_IP].val = mem[mem[GLOBAL_IP].val + 1].val - 1;
+                break;
+            case OP_JZE:
+                if (mem[mem[GLOBAL_SP].val - 1].val == 0)
+                    mem[GLOBAL_IP].val = mem[mem[GLOBAL_IP].val + 1].val - 1;
+                else
+                    mem[GLOBAL_IP].val += 1;
+                mem[GLOBAL_SP].val -= 1;
+                break;
+            case OP_JNZ:
+                if (mem[mem[GLOBAL_SP].val - 1].val != 0)
+                    mem[GLOBAL_IP].val = mem[mem[GLOBAL_IP].val + 1].val - 1;
+                else
+                    mem[GLOBAL_IP].val += 1;
+                mem[GLOBAL_SP].val -= 1;
+                break;
+            case OP_OR:
+                mem[mem[GLOBAL_SP].val - 2].val |= mem[mem[GLOBAL_SP].val - 1].val;
+                mem[GLOBAL_SP].val -= 1;
+                break;
+            case OP_AND:
+                mem[mem[GLOBAL_SP].val - 2].val &= mem[mem[GLOBAL_SP].val - 1].val;
+                mem[GLOBAL_SP].val -= 1;
+                break;
+            case OP_EQ:
+                mem[mem[GLOBAL_SP].val - 2].val =
+                    (mem[mem[GLOBAL_SP].val - 2].val == mem[mem[GLOBAL_SP].val - 1].val);
+                mem[GLOBAL_SP].val -= 1;
+                break;
+            case OP_NE:
+                mem[mem[GLOBAL_SP].val - 2].val =
+                    (mem[mem[GLOBAL_SP].val - 2].val != mem[mem[GLOBAL_SP].val - 1].val);
+                mem[GLOBAL_SP].val -= 1;
+                break;
+            case OP_LT:
+                mem[mem[GLOBAL_SP].val - 2].val =
+                    (mem[mem[GLOBAL_SP].val - 2].val < mem[mem[GLOBAL_SP].val - 1].val);
+                mem[GLOBAL_SP].val -= 1;
+                break;
+            case OP_GT:
+                mem[mem[GLOBAL_SP].val - 2].val =
+                    (mem[mem[GLOBAL_SP].val - 2].val > mem[mem[GLOBAL_SP].val - 1].val);
+                mem[GLOBAL_SP].val -= 1;
+                break;
+            case OP_ADD:
+                mem[mem[GLOBAL_SP].val - 2].val += mem[mem[GLOBAL_SP].val - 1].val;
+                mem[GLOBAL_SP].val -= 1;
+                break;
+            case OP_SUB:
+                mem[mem[GLOBAL_SP].val - 2].val -= mem[mem[GLOBAL_SP].val - 1].val;
+                mem[GLOBAL_SP].val -= 1;
+                break;
+            case OP_MUL:
+                mem[mem[GLOBAL_SP].val - 2].val *= mem[mem[GLOBAL_SP].val - 1].val;
+                mem[GLOBAL_SP].val -= 1;
+                break;
+            case OP_DIV:
+                mem[mem[GLOBAL_SP].val - 2].val /= mem[mem[GLOBAL_SP].val - 1].val;
+                mem[GLOBAL_SP].val -= 1;
+                break;
+            case OP_MOD:
+                mem[mem[GLOBAL_SP].val - 2].val %= mem[mem[GLOBAL_SP].val - 1].val;
+                mem[GLOBAL_SP].val -= 1;
+                break;
+            case OP_SVC:
+                a1 = mem[GLOBAL_IO].val;
+                if (a1 == 0) {
+                    read(STDIN_FILENO, &mem[mem[GLOBAL_SP].val - 1].val, 1);
+                } else if (a1 == 1) {
+                    write(STDOUT_FILENO, &mem[mem[GLOBAL_SP].val - 1].val, 1);
+                } else if (a1 == 2) {
+                    usleep(mem[mem[GLOBAL_SP].val - 1].val * 1000);
+                } else {
+                    mem[mem[GLOBAL_SP].val - 1].val = svc_mem(mem, a1, mem[mem[GLOBAL_SP].val - 1].val);
+                }
+                break;
+            case OP_SVCK:
+                (mem[GLOBAL_IP].val)++;
+                a1 = mem[mem[GLOBAL_IP].val].val;
+                mem[mem[GLOBAL_SP].val - 1].val = svc_io(mem, a1, mem[mem[GLOBAL_SP].val - 1].val);
+                break;
+            case OP_VEC_INIT:
+                mem[mem[mem[GLOBAL_SP].val - 1].val].val = 0;
+                mem[mem[GLOBAL_SP].val - 1].val = 0;
+                break;
+            case OP_VEC_SIZE:
+                mem[mem[GLOBAL_SP].val - 1].val = mem[mem[mem[GLOBAL_SP].val - 1].val].val;
+                break;
+            case OP_VEC_GET:
+                a1 = mem[mem[GLOBAL_SP].val - 2].val;
+                a2 = mem[mem[GLOBAL_SP].val - 1].val;
+#ifndef NDEBUG
+                if (a2 < 0 || a2 >= mem[a1].val)
+                    return ERR_VEC_RANGE;
+#endif
+                mem[mem[GLOBAL_SP].val - 2].val = mem[a1 + a2 + 1].val;
+                mem[GLOBAL_SP].val -= 1;
+                break;
+            case OP_VEC_SET:
+                a1 = mem[mem[GLOBAL_SP].val - 3].val;
+                a2 = mem[mem[GLOBAL_SP].val - 2].val;
+#ifndef NDEBUG
+                if (a2 < 0 || a2 >= mem[a1].val)
+                    return ERR_VEC_RANGE;
+#endif
+                mem[a1 + a2 + 1].val = mem[mem[GLOBAL_SP].val - 1].val;
+                mem[mem[GLOBAL_SP].val - 3].val = mem[mem[GLOBAL_SP].val - 1].val;
+                mem[GLOBAL_SP].val -= 2;
+                break;
+            case OP_LOAD8:
+                a1 = mem[mem[GLOBAL_SP].val - 2].val;
+                a2 = mem[mem[GLOBAL_SP].val - 1].val;
+#ifndef NDEBUG
+                if (a2 < 0 || a2 >= mem[a1].val)
+                    return ERR_VEC_RANGE;
+#endif
+                mem[mem[GLOBAL_SP].val - 2].val = ((unsigned char*)&mem[a1 + 1])[a2];
+                mem[GLOBAL_SP].val -= 1;
+                break;
+            case OP_STORE8:
+                a1 = mem[mem[GLOBAL_SP].val - 3].val;
+                a2 = mem[mem[GLOBAL_SP].val - 2].val;
+#ifndef NDEBUG
+                if (a2 < 0 || a2 >= mem[a1].val)
+                    return ERR_VEC_RANGE;
+#endif
+                ((unsigned char*)&mem[a1 + 1])[a2] = mem[mem[GLOBAL_SP].val - 1].val;
+                mem[mem[GLOBAL_SP].val - 3].val = mem[mem[GLOBAL_SP].val - 1].val;
+                mem[GLOBAL_SP].val -= 2;
+                break;
+            case OP_FADD:
+                mem[mem[GLOBAL_SP].val - 2].num += mem[mem[GLOBAL_SP].val - 1].num;
+                mem[GLOBAL_SP].val -= 1;
+                break;
+            case OP_FSUB:
+                mem[mem[GLOBAL_SP].val - 2].num -= mem[mem[GLOBAL_SP].val - 1].num;
+                mem[GLOBAL_SP].val -= 1;
+                break;
+            case OP_FMUL:
+                mem[mem[GLOBAL_SP].val - 2].num *= mem[mem[GLOBAL_SP].val - 1].num;
+                mem[GLOBAL_SP].val -= 1;
+                break;
+            case OP_FDIV:
+                mem[mem[GLOBAL_SP].val - 2].num /= mem[mem[GLOBAL_SP].val - 1].num;
+                mem[GLOBAL_SP].val -= 1;
+                break;
+            case OP_FCMP:
+                a1 = mem[mem[GLOBAL_SP].val - 2].num > mem[mem[GLOBAL_SP].val - 1].num;
+                a2 = mem[mem[GLOBAL_SP].val - 2].num < mem[mem[GLOBAL_SP].val - 1].num;
+                mem[mem[GLOBAL_SP].val - 2].val = a1 - a2;
+                mem[GLOBAL_SP].val -= 1;
+                break;
+            case OP_ITOF:
+                mem[mem[GLOBAL_SP].val - 1].num = mem[mem[GLOBAL_SP].val - 1].val;
+                break;
+            case OP_FTOI:
+                mem[mem[GLOBAL_SP].val - 1].val = float_to_int(mem[mem[GLOBAL_SP].val - 1].num);
+                break;
+            case OP_FOR:
+                a1 = mem[GLOBAL_IP].val;
+                if (++mem[mem[GLOBAL_BP].val + mem[a1 + 1].val].val < mem[a1 + 2].val)
+                    mem[GLOBAL_IP].val = mem[a1 + 3].val - 1;
+                else
+                    mem[GLOBAL_IP].val += 3;
+                break;
+            case OP_SWITCH:
+            case OP_SEARCH:
+                a1 = mem[GLOBAL_IP].val;
+                a2 = switch_entry(mem, mem[a1].op, a1 + 2, mem[a1 + 1].val, mem[--mem[GLOBAL_SP].val].val);
+                mem[GLOBAL_IP].val = mem[a2 + 2].val - 1;
+                break;
+            case OP_VEC_PUSH:
+                a1 = mem[mem[GLOBAL_SP].val - 2].val;
+#ifndef NDEBUG
+                if (a1 + mem[a1].val + 1 >= arena.words)
+                    return ERR_VEC_RANGE;
+#endif
+                a2 = ++mem[a1].val;
+                mem[a1 + a2].val = mem[mem[GLOBAL_SP].val - 1].val;
+                mem[mem[GLOBAL_SP].val - 2].val = a2;
+                mem[GLOBAL_SP].val -= 1;
+                break;
+            case OP_VEC_POP:
+                a1 = mem[mem[GLOBAL_SP].val - 1].val;
+#ifndef NDEBUG
+                if (mem[a1].val <= 0)
+                    return ERR_VEC_RANGE;
+#endif
+                mem[mem[GLOBAL_SP].val - 1].val = mem[a1 + mem[a1].val].val;
+                mem[a1].val--;
+                break;
+            case OP_CHECK:
+                a1 = check_inst(mem);
+                if (a1 != ERR_NONE)
+                    return a1;
+                break;
+            case OP_PROFILE:
+                a1 = mem[GLOBAL_IP].val + 1;
+                a2 = mem[mem[GLOBAL_SP].val - 1].val;
+                pgo_count(a1, mem[a1].op == OP_JZE ? a2 == 0 : mem[a1].op == OP_JNZ ? a2 != 0 : true);
+                break;
+            case OP_TAILCALL:
+                a1 = mem[mem[GLOBAL_IP].val + 2].val;
+                a2 = mem[mem[GLOBAL_BP].val - 2].val;
+                a3 = mem[mem[GLOBAL_BP].val - 3].val;
+                a4 = mem[mem[GLOBAL_BP].val - 1].val;
+                for (int i = 0; i < a1; i++)
+                    mem[a2 + i].val = mem[mem[GLOBAL_SP].val - a1 + i].val;
+                mem[GLOBAL_SP].val = a2 + a1;
+                mem[(mem[GLOBAL_SP].val) + 0].val = a3;
+                mem[(mem[GLOBAL_SP].val) + 1].val = mem[GLOBAL_SP].val;
+                mem[(mem[GLOBAL_SP].val) + 2].val = a4;
+                mem[GLOBAL_IP].val = mem[mem[GLOBAL_IP].val + 1].val - 1;
+                mem[GLOBAL_BP].val = mem[GLOBAL_SP].val + 3;
+                mem[GLOBAL_SP].val += STK_SZ;
+                break;
+            default:
+                a1 = mem[mem[GLOBAL_IP].val].val;
+                if (a1 >= OP_PUSH_LOCAL)
+                    mem[(mem[GLOBAL_SP].val)++].val = mem[GLOBAL_BP].val + a1 - OP_PUSH_LOCAL - STK_SZ;
+                else if (a1 >= OP_PUSH_SMALL)
+                    mem[(mem[GLOBAL_SP].val)++].val = a1 - OP_PUSH_SMALL - SMALL_SZ / 2;
+                break;
+        }
+        (mem[GLOBAL_IP].val)++;
+    }
+    return ERR_NONE;
+}
+
+// Runs code from to_registers. Every instruction first moves GLOBAL_IP to
+// its last word, as the stack VM leaves it, so a store into GLOBAL_IP stops
+// or redirects the program the same way.
+enum err run_registers(union mem* mem) {
+    int a1;
+    int a2;
+    int a3;
+    int a4;
+    while (mem[mem[GLOBAL_IP].val].op != OP_NULL) {
+        union mem* inst = &mem[mem[GLOBAL_IP].val];
+        int bp = mem[GLOBAL_BP].val;
+        switch (BENCH_STEP(inst->op)) {
+            case OP_MOV:
+                mem[GLOBAL_IP].val += 2;
+                mem[bp + inst[1].val].val = mem[bp + inst[2].val].val;
+                break;
+            case OP_MOVK:
+                mem[GLOBAL_IP].val += 2;
+                mem[bp + inst[1].val].val = inst[2].val;
+                break;
+            case OP_LEA:
+                mem[GLOBAL_IP].val += 2;
+                mem[bp + inst[1].val].val = bp + inst[2].val;
+                break;
+            case OP_LOAD:
+                mem[GLOBAL_IP].val += 2;
+                mem[bp + inst[1].val].val = mem[mem[bp + inst[2].val].val].val;
+                break;
+            case OP_STORE:
+                mem[GLOBAL_IP].val += 2;
+                mem[mem[bp + inst[1].val].val].val = mem[bp + inst[2].val].val;
+                break;
+            case OP_CALL:
+                a1 = mem[GLOBAL_SP].val;
+                a2 = inst[3].val;
+                for (int i = 0; i < a2; i++)
+                    mem[a1 + i].val = mem[bp + inst[2].val + i].val;
+                a1 += a2;
+                mem[a1 + 0].val = mem[GLOBAL_IP].val + 3;
+                mem[a1 + 1].val = a1;
+                mem[a1 + 2].val = bp;
+                mem[GLOBAL_IP].val = inst[1].val - 1;
+                mem[GLOBAL_BP].val = a1 + 3;
+                mem[GLOBAL_SP].val = a1 + STK_SZ;
+                break;
+            case OP_TAILCALL:
+                a1 = inst[3].val;
+                a2 = mem[bp - 2].val;
+                a3 = mem[bp - 3].val;
+                a4 = mem[bp - 1].val;
+                for (int i = 0; i < a1; i++)
+                    mem[a2 + i].val = mem[bp + inst[2].val + i].val;
+                a2 += a1;
+                mem[a2 + 0].val = a3;
+                mem[a2 + 1].val = a2;
+                mem[a2 + 2].val = a4;
+                mem[GLOBAL_IP].val = inst[1].val - 1;
+                mem[GLOBAL_BP].val = a2 + 3;
+                mem[GLOBAL_SP].val = a2 + STK_SZ;
+                break;
+            case OP_PROFILE:
+                a1 = inst[1].op == OP_JZE || inst[1].op == OP_JNZ ? mem[bp + inst[2].val].val : 0;
+                pgo_count(mem[GLOBAL_IP].val + 1, inst[1].op == OP_JZE ? a1 == 0 : inst[1].op == OP_JNZ ? a1 != 0 : true);
+                break;
+            case OP_RETURN:
+                a1 = mem[bp + inst[1].val].val;
+                a2 = mem[bp - 3].val;
+                mem[GLOBAL_IP].val = a2;
+                mem[GLOBAL_SP].val = mem[bp - 2].val;
+                mem[GLOBAL_BP].val = mem[bp - 1].val;
+                mem[mem[GLOBAL_BP].val + mem[a2 - 1].val].val = a1;
+                break;
+            case OP_JMP:
+                mem[GLOBAL_IP].val = inst[1].val - 1;
+                break;
+            case OP_JZE:
+                if (mem[bp + inst[1].val].val == 0)
+                    mem[GLOBAL_IP].val = inst[2].val - 1;
+                else
+                    mem[GLOBAL_IP].val += 2;
+                break;
+            case OP_JNZ:
+                if (mem[bp + inst[1].val].val != 0)
+                    mem[GLOBAL_IP].val = inst[2].val - 1;
+                else
+                    mem[GLOBAL_IP].val += 2;
+                break;
+            case OP_SWITCH:
+            case OP_SEARCH:
+                a1 = switch_entry(mem, inst->op, mem[GLOBAL_IP].val + 3, inst[2].val, mem[bp + inst[1].val].val);
+                mem[GLOBAL_IP].val = mem[a1 + 2].val - 1;
+                break;
+            case OP_OR:
+                mem[GLOBAL_IP].val += 3;
+                mem[bp + inst[1].val].val = mem[bp + inst[2].val].val | mem[bp + inst[3].val].val;
+                break;
+            case OP_AND:
+                mem[GLOBAL_IP].val += 3;
+                mem[bp + inst[1].val].val = mem[bp + inst[2].val].val & mem[bp + inst[3].val].val;
+                break;
+            case OP_EQ:
+                mem[GLOBAL_IP].val += 3;
+                mem[bp + inst[1].val].val = mem[bp + inst[2].val].val == mem[bp + inst[3].val].val;
+                break;
+            case OP_NE:
+                mem[GLOBAL_IP].val += 3;
+                mem[bp + inst[1].val].val = mem[bp + inst[2].val].val != mem[bp + inst[3].val].val;
+                break;
+            case OP_LT:
+                mem[GLOBAL_IP].val += 3;
+                mem[bp + inst[1].val].val = mem[bp + inst[2].val].val < mem[bp + inst[3].val].val;
+                break;
+            case OP_GT:
+                mem[GLOBAL_IP].val += 3;
+                mem[bp + inst[1].val].val = mem[bp + inst[2].val].val > mem[bp + inst[3].val].val;
+                break;
+            case OP_ADD:
+                mem[GLOBAL_IP].val += 3;
+                mem[bp + inst[1].val].val = mem[bp + inst[2].val].val + mem[bp + inst[3].val].val;
+                break;
+            case OP_SUB:
+                mem[GLOBAL_IP].val += 3;
+                mem[bp + inst[1].val].val = mem[bp + inst[2].val].val - mem[bp + inst[3].val].val;
+                break;
+            case OP_MUL:
+                mem[GLOBAL_IP].val += 3;
+                mem[bp + inst[1].val].val = mem[bp + inst[2].val].val * mem[bp + inst[3].val].val;
+                break;
+            case OP_DIV:
+                mem[GLOBAL_IP].val += 3;
+                mem[bp + inst[1].val].val = mem[bp + inst[2].val].val / mem[bp + inst[3].val].val;
+                break;
+            case OP_MOD:
+                mem[GLOBAL_IP].val += 3;
+                mem[bp + inst[1].val].val = mem[bp + inst[2].val].val % mem[bp + inst[3].val].val;
+                break;
+            case OP_ORK:
+                mem[GLOBAL_IP].val += 3;
+                mem[bp + inst[1].val].val = mem[bp + inst[2].val].val | inst[3].val;
+                break;
+            case OP_ANDK:
+                mem[GLOBAL_IP].val += 3;
+                mem[bp + inst[1].val].val = mem[bp + inst[2].val].val & inst[3].val;
+                break;
+            case OP_EQK:
+                mem[GLOBAL_IP].val += 3;
+                mem[bp + inst[1].val].val = mem[bp + inst[2].val].val == inst[3].val;
+                break;
+            case OP_NEK:
+                mem[GLOBAL_IP].val += 3;
+                mem[bp + inst[1].val].val = mem[bp + inst[2].val].val != inst[3].val;
+                break;
+            case OP_LTK:
+                mem[GLOBAL_IP].val += 3;
+                mem[bp + inst[1].val].val = mem[bp + inst[2].val].val < inst[3].val;
+                break;
+            case OP_GTK:
+                mem[GLOBAL_IP].val += 3;
+                mem[bp + inst[1].val].val = mem[bp + inst[2].val].val > inst[3].val;
+                break;
+            case OP_ADDK:
+                mem[GLOBAL_IP].val += 3;
+                mem[bp + inst[1].val].val = mem[bp + inst[2].val].val + inst[3].val;
+                break;
+            case OP_SUBK:
+                mem[GLOBAL_IP].val += 3;
+                mem[bp + inst[1].val].val = mem[bp + inst[2].val].val - inst[3].val;
+                break;
+            case OP_MULK:
+                mem[GLOBAL_IP].val += 3;
+                mem[bp + inst[1].val].val = mem[bp + inst[2].val].val * inst[3].val;
+                break;
+            case OP_DIVK:
+                mem[GLOBAL_IP].val += 3;
+                mem[bp + inst[1].val].val = mem[bp + inst[2].val].val / inst[3].val;
+                break;
+            case OP_MODK:
+                mem[GLOBAL_IP].val += 3;
+                mem[bp + inst[1].val].val = mem[bp + inst[2].val].val % inst[3].val;
+                break;
+            case OP_SVC:
+                mem[GLOBAL_IP].val += 1;
+                a1 = mem[GLOBAL_IO].val;
+                if (a1 == 0) {
+                    read(STDIN_FILENO, &mem[bp + inst[1].val].val, 1);
+                } else if (a1 == 1) {
+                    write(STDOUT_FILENO, &mem[bp + inst[1].val].val, 1);
+                } else if (a1 == 2) {
+                    usleep(mem[bp + inst[1].val].val * 1000);
+                } else {
+                    mem[bp + inst[1].val].val = svc_mem(mem, a1, mem[bp + inst[1].val].val);
+                }
+                break;
+            case OP_SVCK:
+                mem[GLOBAL_IP].val += 2;
+                mem[bp + inst[1].val].val = svc_io(mem, inst[2].val, mem[bp + inst[1].val].val);
+                break;
+            case OP_VEC_INIT:
+                mem[GLOBAL_IP].val += 2;
+                mem[mem[bp + inst[2].val].val].val = 0;
+                mem[bp + inst[1].val].val = 0;
+                break;
+            case OP_VEC_SIZE:
+                mem[GLOBAL_IP].val += 2;
+                mem[bp + inst[1].val].val = mem[mem[bp + inst[2].val].val].val;
+                break;
+            case OP_VEC_GET:
+                a1 = mem[bp + inst[2].val].val;
+                a2 = mem[bp + inst[3].val].val;
+#ifndef NDEBUG
+                if (a2 < 0 || a2 >= mem[a1].val)
+                    return ERR_VEC_RANGE;
+#endif
+                mem[GLOBAL_IP].val += 3;
+                mem[bp + inst[1].val].val = mem[a1 + a2 + 1].val;
+                break;
+            case OP_VEC_SET:
+                a1 = mem[bp + inst[2].val].val;
+                a2 = mem[bp + inst[3].val].val;
+#ifndef NDEBUG
+                if (a2 < 0 || a2 >= mem[a1].val)
+                    return ERR_VEC_RANGE;
+#endif
+                a3 = mem[bp + inst[4].val].val;
+                mem[GLOBAL_IP].val += 4;
+                mem[a1 + a2 + 1].val = a3;
+                mem[bp + inst[1].val].val = a3;
+                break;
+            case OP_LOAD8:
+                a1 = mem[bp + inst[2].val].val;
+                a2 = mem[bp + inst[3].val].val;
+#ifndef NDEBUG
+                if (a2 < 0 || a2 >= mem[a1].val)
+                    return ERR_VEC_RANGE;
+#endif
+                mem[GLOBAL_IP].val += 3;
+                mem[bp + inst[1].val].val = ((unsigned char*)&mem[a1 + 1])[a2];
+                break;
+            case OP_STORE8:
+                a1 = mem[bp + inst[2].val].val;
+                a2 = mem[bp + inst[3].val].val;
+#ifndef NDEBUG
+                if (a2 < 0 || a2 >= mem[a1].val)
+                    return ERR_VEC_RANGE;
+#endif
+                a3 = mem[bp + inst[4].val].val;
+                mem[GLOBAL_IP].val += 4;
+                ((unsigned char*)&mem[a1 + 1])[a2] = a3;
+                mem[bp + inst[1].val].val = a3;
+                break;
+            case OP_FADD:
+                mem[GLOBAL_IP].val += 3;
+                mem[bp + inst[1].val].num = mem[bp + inst[2].val].num + mem[bp + inst[3].val].num;
+                break;
+            case OP_FSUB:
+                mem[GLOBAL_IP].val += 3;
+                mem[bp + inst[1].val].num = mem[bp + inst[2].val].num - mem[bp + inst[3].val].num;
+                break;
+            case OP_FMUL:
+                mem[GLOBAL_IP].val += 3;
+                mem[bp + inst[1].val].num = mem[bp + inst[2].val].num * mem[bp + inst[3].val].num;
+                break;
+            case OP_FDIV:
+                mem[GLOBAL_IP].val += 3;
+                mem[bp + inst[1].val].num = mem[bp + inst[2].val].num / mem[bp + inst[3].val].num;
+                break;
+            case OP_FCMP:
+                mem[GLOBAL_IP].val += 3;
+                a1 = mem[bp + inst[2].val].num > mem[bp + inst[3].val].num;
+                a2 = mem[bp + inst[2].val].num < mem[bp + inst[3].val].num;
+                mem[bp + inst[1].val].val = a1 - a2;
+                break;
+            case OP_ITOF:
+                mem[GLOBAL_IP].val += 2;
+                mem[bp + inst[1].val].num = mem[bp + inst[2].val].val;
+                break;
+            case OP_FTOI:
+                mem[GLOBAL_IP].val += 2;
+                mem[bp + inst[1].val].val = float_to_int(mem[bp + inst[2].val].num);
+                break;
+            case OP_VEC_PUSH:
+                a1 = mem[bp + inst[2].val].val;
+#ifndef NDEBUG
+                if (a1 + mem[a1].val + 1 >= arena.words)
+                    return ERR_VEC_RANGE;
+#endif
+                a3 = mem[bp + inst[3].val].val;
+                mem[GLOBAL_IP].val += 3;
+                a2 = ++mem[a1].val;
+                mem[a1 + a2].val = a3;
+                mem[bp + inst[1].val].val = a2;
+                break;
+            case OP_VEC_POP:
+                a1 = mem[bp + inst[2].val].val;
+#ifndef NDEBUG
+                if (mem[a1].val <= 0)
+                    return ERR_VEC_RANGE;
+#endif
+                mem[GLOBAL_IP].val += 2;
+                mem[bp + inst[1].val].val = mem[a1 + mem[a1].val].val;
+                mem[a1].val--;
+                break;
+            default:
+                break;
+        }
+        (mem[GLOBAL_IP].val)++;
+    }
+    return ERR_NONE;
+}
+
+// Runs code from pack_image. IP is a byte offset into code and, as in
+// run_script, each instruction leaves it on its own last byte.
+enum err run_packed(union mem* mem, const unsigned char* code) {
+    int a1;
+    int a2;
+    int a3;
+    int a4;
+    while (code[mem[GLOBAL_IP].val] != OP_NULL) {
+        switch (BENCH_STEP(code[mem[GLOBAL_IP].val])) {
+            case OP_NULL:
+                break;
+            case OP_NOP:
+                break;
+            case OP_PUSH_CONST:
+                mem[(mem[GLOBAL_SP].val)++].val = unpack_i32(&code[mem[GLOBAL_IP].val + 1]);
+                mem[GLOBAL_IP].val += 4;
+                break;
+            case OP_PUSH_VARADDR:
+                mem[(mem[GLOBAL_SP].val)++].val = mem[GLOBAL_BP].val + unpack_i16(&code[mem[GLOBAL_IP].val + 1]);
+                mem[GLOBAL_IP].val += 2;
                 break;
             case OP_TEST01:
                 break;
@@ -513,10 +6020,10 @@ void run_script(union mem* mem) {
                 mem[GLOBAL_SP].val -= 2;
                 break;
             case OP_CALL:
-                mem[(mem[GLOBAL_SP].val) + 0].val = mem[GLOBAL_IP].val + 1;
+                mem[(mem[GLOBAL_SP].val) + 0].val = mem[GLOBAL_IP].val + 4;
                 mem[(mem[GLOBAL_SP].val) + 1].val = mem[GLOBAL_SP].val;
                 mem[(mem[GLOBAL_SP].val) + 2].val = mem[GLOBAL_BP].val;
-                mem[GLOBAL_IP].val = mem[mem[GLOBAL_IP].val + 1].val - 1;
+                mem[GLOBAL_IP].val = unpack_i32(&code[mem[GLOBAL_IP].val + 1]) - 1;
                 mem[GLOBAL_BP].val = mem[GLOBAL_SP].val + 3;
                 mem[GLOBAL_SP].val += STK_SZ;
                 break;
@@ -529,13 +6036,20 @@ void run_script(union mem* mem) {
                 mem[GLOBAL_SP].val++;
                 break;
             case OP_JMP:
-                mem[GLOBAL_IP].val = mem[mem[GLOBAL_IP].val + 1].val - 1;
+                mem[GLOBAL_IP].val = unpack_i32(&code[mem[GLOBAL_IP].val + 1]) - 1;
                 break;
             case OP_JZE:
                 if (mem[mem[GLOBAL_SP].val - 1].val == 0)
-                    mem[GLOBAL_IP].val = mem[mem[GLOBAL_IP].val + 1].val - 1;
+                    mem[GLOBAL_IP].val = unpack_i32(&code[mem[GLOBAL_IP].val + 1]) - 1;
                 else
-                    mem[GLOBAL_IP].val += 1;
+                    mem[GLOBAL_IP].val += 4;
+                mem[GLOBAL_SP].val -= 1;
+                break;
+            case OP_JNZ:
+                if (mem[mem[GLOBAL_SP].val - 1].val != 0)
+                    mem[GLOBAL_IP].val = unpack_i32(&code[mem[GLOBAL_IP].val + 1]) - 1;
+                else
+                    mem[GLOBAL_IP].val += 4;
                 mem[GLOBAL_SP].val -= 1;
                 break;
             case OP_OR:
@@ -594,16 +6108,793 @@ void run_script(union mem* mem) {
                     write(STDOUT_FILENO, &mem[mem[GLOBAL_SP].val - 1].val, 1);
                 } else if (a1 == 2) {
                     usleep(mem[mem[GLOBAL_SP].val - 1].val * 1000);
+                } else {
+                    mem[mem[GLOBAL_SP].val - 1].val = svc_mem(mem, a1, mem[mem[GLOBAL_SP].val - 1].val);
                 }
                 break;
+            case OP_SVCK:
+                a1 = unpack_i32(&code[mem[GLOBAL_IP].val + 1]);
+                mem[mem[GLOBAL_SP].val - 1].val = svc_io(mem, a1, mem[mem[GLOBAL_SP].val - 1].val);
+                mem[GLOBAL_IP].val += 4;
+                break;
+            case OP_VEC_INIT:
+                mem[mem[mem[GLOBAL_SP].val - 1].val].val = 0;
+                mem[mem[GLOBAL_SP].val - 1].val = 0;
+                break;
+            case OP_VEC_SIZE:
+                mem[mem[GLOBAL_SP].val - 1].val = mem[mem[mem[GLOBAL_SP].val - 1].val].val;
+                break;
+            case OP_VEC_GET:
+                a1 = mem[mem[GLOBAL_SP].val - 2].val;
+                a2 = mem[mem[GLOBAL_SP].val - 1].val;
+#ifndef NDEBUG
+                if (a2 < 0 || a2 >= mem[a1].val)
+                    return ERR_VEC_RANGE;
+#endif
+                mem[mem[GLOBAL_SP].val - 2].val = mem[a1 + a2 + 1].val;
+                mem[GLOBAL_SP].val -= 1;
+                break;
+            case OP_VEC_SET:
+                a1 = mem[mem[GLOBAL_SP].val - 3].val;
+                a2 = mem[mem[GLOBAL_SP].val - 2].val;
+#ifndef NDEBUG
+                if (a2 < 0 || a2 >= mem[a1].val)
+                    return ERR_VEC_RANGE;
+#endif
+                mem[a1 + a2 + 1].val = mem[mem[GLOBAL_SP].val - 1].val;
+                mem[mem[GLOBAL_SP].val - 3].val = mem[mem[GLOBAL_SP].val - 1].val;
+                mem[GLOBAL_SP].val -= 2;
+                break;
+            case OP_LOAD8:
+                a1 = mem[mem[GLOBAL_SP].val - 2].val;
+                a2 = mem[mem[GLOBAL_SP].val - 1].val;
+#ifndef NDEBUG
+                if (a2 < 0 || a2 >= mem[a1].val)
+                    return ERR_VEC_RANGE;
+#endif
+                mem[mem[GLOBAL_SP].val - 2].val = ((unsigned char*)&mem[a1 + 1])[a2];
+                mem[GLOBAL_SP].val -= 1;
+                break;
+            case OP_STORE8:
+                a1 = mem[mem[GLOBAL_SP].val - 3].val;
+                a2 = mem[mem[GLOBAL_SP].val - 2].val;
+#ifndef NDEBUG
+                if (a2 < 0 || a2 >= mem[a1].val)
+                    return ERR_VEC_RANGE;
+#endif
+                ((unsigned char*)&mem[a1 + 1])[a2] = mem[mem[GLOBAL_SP].val - 1].val;
+                mem[mem[GLOBAL_SP].val - 3].val = mem[mem[GLOBAL_SP].val - 1].val;
+                mem[GLOBAL_SP].val -= 2;
+                break;
+            case OP_FADD:
+                mem[mem[GLOBAL_SP].val - 2].num += mem[mem[GLOBAL_SP].val - 1].num;
+                mem[GLOBAL_SP].val -= 1;
+                break;
+            case OP_FSUB:
+                mem[mem[GLOBAL_SP].val - 2].num -= mem[mem[GLOBAL_SP].val - 1].num;
+                mem[GLOBAL_SP].val -= 1;
+                break;
+            case OP_FMUL:
+                mem[mem[GLOBAL_SP].val - 2].num *= mem[mem[GLOBAL_SP].val - 1].num;
+                mem[GLOBAL_SP].val -= 1;
+                break;
+            case OP_FDIV:
+                mem[mem[GLOBAL_SP].val - 2].num /= mem[mem[GLOBAL_SP].val - 1].num;
+                mem[GLOBAL_SP].val -= 1;
+                break;
+            case OP_FCMP:
+                a1 = mem[mem[GLOBAL_SP].val - 2].num > mem[mem[GLOBAL_SP].val - 1].num;
+                a2 = mem[mem[GLOBAL_SP].val - 2].num < mem[mem[GLOBAL_SP].val - 1].num;
+                mem[mem[GLOBAL_SP].val - 2].val = a1 - a2;
+                mem[GLOBAL_SP].val -= 1;
+                break;
+            case OP_ITOF:
+                mem[mem[GLOBAL_SP].val - 1].num = mem[mem[GLOBAL_SP].val - 1].val;
+                break;
+            case OP_FTOI:
+                mem[mem[GLOBAL_SP].val - 1].val = float_to_int(mem[mem[GLOBAL_SP].val - 1].num);
+                break;
+            case OP_FOR:
+                a1 = ++mem[mem[GLOBAL_BP].val + unpack_i16(&code[mem[GLOBAL_IP].val + 1])].val;
+                if (a1 < unpack_i32(&code[mem[GLOBAL_IP].val + 3]))
+                    mem[GLOBAL_IP].val = unpack_i32(&code[mem[GLOBAL_IP].val + 7]) - 1;
+                else
+                    mem[GLOBAL_IP].val += 10;
+                break;
+            case OP_SWITCH:
+            case OP_SEARCH:
+                a1 = mem[GLOBAL_IP].val;
+                a2 = packed_entry(code, code[a1], a1 + 5, unpack_i32(&code[a1 + 1]), mem[--mem[GLOBAL_SP].val].val);
+                mem[GLOBAL_IP].val = unpack_i32(&code[a2 + 5]) - 1;
+                break;
+            case OP_VEC_PUSH:
+                a1 = mem[mem[GLOBAL_SP].val - 2].val;
+#ifndef NDEBUG
+                if (a1 + mem[a1].val + 1 >= arena.words)
+                    return ERR_VEC_RANGE;
+#endif
+                a2 = ++mem[a1].val;
+                mem[a1 + a2].val = mem[mem[GLOBAL_SP].val - 1].val;
+                mem[mem[GLOBAL_SP].val - 2].val = a2;
+                mem[GLOBAL_SP].val -= 1;
+                break;
+            case OP_VEC_POP:
+                a1 = mem[mem[GLOBAL_SP].val - 1].val;
+#ifndef NDEBUG
+                if (mem[a1].val <= 0)
+                    return ERR_VEC_RANGE;
+#endif
+                mem[mem[GLOBAL_SP].val - 1].val = mem[a1 + mem[a1].val].val;
+                mem[a1].val--;
+                break;
+            case OP_TAILCALL:
+                a1 = unpack_i16(&code[mem[GLOBAL_IP].val + 5]);
+                a2 = mem[mem[GLOBAL_BP].val - 2].val;
+                a3 = mem[mem[GLOBAL_BP].val - 3].val;
+                a4 = mem[mem[GLOBAL_BP].val - 1].val;
+                for (int i = 0; i < a1; i++)
+                    mem[a2 + i].val = mem[mem[GLOBAL_SP].val - a1 + i].val;
+                mem[GLOBAL_SP].val = a2 + a1;
+                mem[(mem[GLOBAL_SP].val) + 0].val = a3;
+                mem[(mem[GLOBAL_SP].val) + 1].val = mem[GLOBAL_SP].val;
+                mem[(mem[GLOBAL_SP].val) + 2].val = a4;
+                mem[GLOBAL_IP].val = unpack_i32(&code[mem[GLOBAL_IP].val + 1]) - 1;
+                mem[GLOBAL_BP].val = mem[GLOBAL_SP].val + 3;
+                mem[GLOBAL_SP].val += STK_SZ;
+                break;
             default:
                 break;
         }
         (mem[GLOBAL_IP].val)++;
     }
+    return ERR_NONE;
+}
+
+static const char* emit_prelude =
+    "#include <fcntl.h>\n"
+    "#include <limits.h>\n"
+    "#include <unistd.h>\n"
+    "\n"
+    "#define IP mem[1]\n"
+    "#define SP mem[2]\n"
+    "#define BP mem[3]\n"
+    "#define IO mem[4]\n"
+    "\n"
+    "void out_int(char* buf, int* size, int x) {\n"
+    "    char tmp[12];\n"
+    "    int n = 0;\n"
+    "    unsigned u = x < 0 ? -(unsigned)x : (unsigned)x;\n"
+    "    if (x < 0)\n"
+    "        buf[(*size)++] = '-';\n"
+    "    do {\n"
+    "        tmp[n++] = '0' + u % 10;\n"
+    "        u /= 10;\n"
+    "    } while (u != 0);\n"
+    "    while (n != 0)\n"
+    "        buf[(*size)++] = tmp[--n];\n"
+    "}\n"
+    "\n"
+    "void out_memory(int* mem) {\n"
+    "    static char buf[DUMP_SZ * 12];\n"
+    "    int fd = open(\"Scratch.txt\", O_WRONLY | O_CREAT | O_TRUNC, 0666);\n"
+    "    int size = 0;\n"
+    "    for (int i = 1; i < DUMP_SZ; i++) {\n"
+    "        out_int(buf, &size, mem[i]);\n"
+    "        buf[size++] = '\\n';\n"
+    "    }\n"
+    "    write(fd, buf, size);\n"
+    "    close(fd);\n"
+    "}\n"
+    "\n"
+    "float num(int x) {\n"
+    "    return (union {int i; float f;}){.i = x}.f;\n"
+    "}\n"
+    "\n"
+    "int bits(float x) {\n"
+    "    return (union {float f; int i;}){.f = x}.i;\n"
+    "}\n"
+    "\n"
+    "int float_to_int(float x) {\n"
+    "    if (x != x)\n"
+    "        return 0;\n"
+    "    if (x >= 2147483648.0f)\n"
+    "        return INT_MAX;\n"
+    "    return x <= -2147483648.0f ? INT_MIN : (int)x;\n"
+    "}\n"
+    "\n"
+    "int heap_top = MEM_SZ / 2;\n"
+    "int heap_free[HEAP_CLASSES];\n"
+    "signed char heap_cls[MEM_SZ];\n"
+    "\n"
+    "int alloc(int* mem, int size) {\n"
+    "    int c = 1;\n"
+    "    int p;\n"
+    "    int a;\n"
+    "    if (size < 0)\n"
+    "        return 0;\n"
+    "    while ((1L << c) < size + 1L)\n"
+    "        c++;\n"
+    "    if (c >= HEAP_CLASSES)\n"
+    "        return 0;\n"
+    "    if (heap_free[c] != 0) {\n"
+    "        p = heap_free[c];\n"
+    "        a = mem[p];\n"
+    "        heap_free[c] = a > MEM_SZ / 2 && a < heap_top && heap_cls[a] == -c ? a : 0;\n"
+    "    } else {\n"
+    "        if (heap_top + (1L << c) > MEM_SZ)\n"
+    "            return 0;\n"
+    "        p = heap_top + 1;\n"
+    "        heap_top += 1 << c;\n"
+    "    }\n"
+    "    mem[p - 1] = c;\n"
+    "    heap_cls[p] = c;\n"
+    "    return p;\n"
+    "}\n"
+    "\n"
+    "int release(int* mem, int p) {\n"
+    "    if (p <= MEM_SZ / 2 || p >= heap_top || heap_cls[p] <= 0)\n"
+    "        return -1;\n"
+    "    mem[p] = heap_free[heap_cls[p]];\n"
+    "    heap_free[heap_cls[p]] = p;\n"
+    "    heap_cls[p] = -heap_cls[p];\n"
+    "    mem[p - 1] = heap_cls[p];\n"
+    "    return 0;\n"
+    "}\n"
+    "\n"
+    "int alloc_bytes(int* mem, int n) {\n"
+    "    int p = n < 0 ? 0 : alloc(mem, (int)((n + 3L) / 4 + 1));\n"
+    "    if (p != 0)\n"
+    "        mem[p] = n;\n"
+    "    return p;\n"
+    "}\n"
+    "\n"
+    "void svc(int* mem, int io, int* x) {\n"
+    "    if (io == 0)\n"
+    "        read(STDIN_FILENO, x, 1);\n"
+    "    else if (io == 1)\n"
+    "        write(STDOUT_FILENO, x, 1);\n"
+    "    else if (io == 2)\n"
+    "        usleep(*x * 1000);\n"
+    "    else if (io == 3)\n"
+    "        *x = alloc(mem, *x);\n"
+    "    else if (io == 4)\n"
+    "        *x = release(mem, *x);\n"
+    "    else if (io == 5)\n"
+    "        *x = alloc_bytes(mem, *x);\n"
+    "    else if ((io == 6 || io == 7) && (*x <= MEM_SZ / 2 || *x >= heap_top || mem[*x] < 0 || *x + 1 + (mem[*x] + 3L) / 4 > heap_top))\n"
+    "        *x = -1;\n"
+    "    else if (io == 6)\n"
+    "        *x = read(STDIN_FILENO, &mem[*x + 1], mem[*x]);\n"
+    "    else if (io == 7)\n"
+    "        *x = write(STDOUT_FILENO, &mem[*x + 1], mem[*x]);\n"
+    "}\n"
+    "\n"
+    "int fail(int* mem, const char* msg, int ip) {\n"
+    "    char buf[BUF_SZ];\n"
+    "    int size = 0;\n"
+    "    IP = ip;\n"
+    "    for (; *msg != '\\0'; msg++)\n"
+    "        buf[size++] = *msg;\n"
+    "    out_int(buf, &size, ip);\n"
+    "    buf[size++] = ')';\n"
+    "    buf[size++] = '\\n';\n"
+    "    write(STDERR_FILENO, buf, size);\n"
+    "    return 1;\n"
+    "}\n"
+    "\n";
+
+static const char* emit_main =
+    "int main(void) {\n"
+    "    static int mem[MEM_SZ];\n"
+    "    for (int i = 0; i < (int)(sizeof(image) / sizeof(image[0])); i++)\n"
+    "        mem[i] = image[i];\n"
+    "    out_memory(mem);\n"
+    "    return run(mem);\n"
+    "}\n";
+
+void emit_define(char* buf, int* size, const char* name, long x) {
+    out_str(buf, size, "#define ");
+    out_str(buf, size, name);
+    out_push(buf, size, ' ');
+    out_int(buf, size, x);
+    out_push(buf, size, '\n');
+}
+
+void emit_label(char* buf, int* size, int ip) {
+    out_str(buf, size, "L");
+    out_int(buf, size, ip);
+}
+
+// A target that starts no instruction, such as the call to an undefined
+// function, goes to bad instead, so the program stops with an error there
+// as the interpreters do.
+void emit_goto(char* buf, int* size, int ip) {
+    if (!check_target(ip)) {
+        out_str(buf, size, "{\n        IP = ");
+        out_int(buf, size, ip - 1L);
+        out_str(buf, size, ";\n        goto bad;\n    }\n");
+        return;
+    }
+    out_str(buf, size, "goto L");
+    out_int(buf, size, ip);
+    out_str(buf, size, ";\n");
+}
+
+void emit_binop(char* buf, int* size, const char* op) {
+    out_str(buf, size, "    mem[SP - 2] = mem[SP - 2] ");
+    out_str(buf, size, op);
+    out_str(buf, size, " mem[SP - 1];\n    SP -= 1;\n");
+}
+
+void emit_fbinop(char* buf, int* size, const char* op) {
+    out_str(buf, size, "    mem[SP - 2] = bits(num(mem[SP - 2]) ");
+    out_str(buf, size, op);
+    out_str(buf, size, " num(mem[SP - 1]));\n    SP -= 1;\n");
+}
+
+// Emits the vector range check the interpreter makes, failing with the
+// message err_report would print for the same instruction.
+void emit_check(char* buf, int* size, struct debug* debug, int ip, const char* cond) {
+#ifndef NDEBUG
+    out_str(buf, size, "    if (");
+    out_str(buf, size, cond);
+    out_str(buf, size, ")\n        return fail(mem, \"error: vec index out of range at ");
+    out_loc(buf, size, debug, ip);
+    out_str(buf, size, " (ip \", ");
+    out_int(buf, size, ip);
+    out_str(buf, size, ");\n");
+#else
+    (void)buf;
+    (void)size;
+    (void)debug;
+    (void)ip;
+    (void)cond;
+#endif
+}
+
+// Emits the C statements for the instruction at ip, with the same effect on
+// memory as its case in run_script.
+void emit_inst(union mem* mem, struct debug* debug, char* buf, int* size, int ip) {
+    union mem* inst = &mem[ip];
+    emit_label(buf, size, ip);
+    out_str(buf, size, ":\n");
+    switch (inst->op) {
+        case OP_PUSH_CONST:
+            out_str(buf, size, "    mem[SP++] = ");
+            out_int(buf, size, inst[1].val);
+            out_str(buf, size, ";\n");
+            break;
+        case OP_PUSH_VARADDR:
+            out_str(buf, size, "    mem[SP++] = BP + ");
+            out_int(buf, size, inst[1].val);
+            out_str(buf, size, ";\n");
+            break;
+        case OP_GLOBAL_GET:
+            out_str(buf, size, "    mem[SP - 1] = mem[mem[SP - 1]];\n");
+            break;
+        case OP_GLOBAL_SET:
+            out_str(buf, size, "    IP = ");
+            out_int(buf, size, ip);
+            out_str(buf, size, ";\n    mem[mem[SP - 2]] = mem[SP - 1];\n    SP -= 2;\n    if (IP != ");
+            out_int(buf, size, ip);
+            out_str(buf, size, ")\n        goto dispatch;\n");
+            break;
+        case OP_CALL:
+            out_str(buf, size, "    mem[SP + 0] = ");
+            out_int(buf, size, ip + 1);
+            out_str(buf, size, ";\n    mem[SP + 1] = SP;\n    mem[SP + 2] = BP;\n    BP = SP + 3;\n    SP += ");
+            out_int(buf, size, STK_SZ);
+            out_str(buf, size, ";\n    ");
+            emit_goto(buf, size, inst[1].val);
+            break;
+        case OP_TAILCALL:
+            out_str(buf, size, "    a1 = ");
+            out_int(buf, size, inst[2].val);
+            out_str(buf, size, ";\n    a2 = mem[BP - 2];\n    a3 = mem[BP - 3];\n    a4 = mem[BP - 1];\n");
+            out_str(buf, size, "    for (int i = 0; i < a1; i++)\n        mem[a2 + i] = mem[SP - a1 + i];\n");
+            out_str(buf, size, "    SP = a2 + a1;\n    mem[SP + 0] = a3;\n    mem[SP + 1] = SP;\n    mem[SP + 2] = a4;\n");
+            out_str(buf, size, "    BP = SP + 3;\n    SP += ");
+            out_int(buf, size, STK_SZ);
+            out_str(buf, size, ";\n    ");
+            emit_goto(buf, size, inst[1].val);
+            break;
+        case OP_RETURN:
+            out_str(buf, size, "    a1 = mem[SP - 1];\n    IP = mem[BP - 3];\n    SP = mem[BP - 2];\n    BP = mem[BP - 1];\n");
+            out_str(buf, size, "    mem[SP++] = a1;\n    goto dispatch;\n");
+            break;
+        case OP_JMP:
+            out_str(buf, size, "    ");
+            emit_goto(buf, size, inst[1].val);
+            break;
+        case OP_JZE:
+            out_str(buf, size, "    if (mem[--SP] == 0)\n        ");
+            emit_goto(buf, size, inst[1].val);
+            break;
+        case OP_JNZ:
+            out_str(buf, size, "    if (mem[--SP] != 0)\n        ");
+            emit_goto(buf, size, inst[1].val);
+            break;
+        case OP_OR:
+            emit_binop(buf, size, "|");
+            break;
+        case OP_AND:
+            emit_binop(buf, size, "&");
+            break;
+        case OP_EQ:
+            emit_binop(buf, size, "==");
+            break;
+        case OP_NE:
+            emit_binop(buf, size, "!=");
+            break;
+        case OP_LT:
+            emit_binop(buf, size, "<");
+            break;
+        case OP_GT:
+            emit_binop(buf, size, ">");
+            break;
+        case OP_ADD:
+            emit_binop(buf, size, "+");
+            break;
+        case OP_SUB:
+            emit_binop(buf, size, "-");
+            break;
+        case OP_MUL:
+            emit_binop(buf, size, "*");
+            break;
+        case OP_DIV:
+            emit_binop(buf, size, "/");
+            break;
+        case OP_MOD:
+            emit_binop(buf, size, "%");
+            break;
+        case OP_SVC:
+            out_str(buf, size, "    svc(mem, IO, &mem[SP - 1]);\n");
+            break;
+        case OP_SVCK:
+            out_str(buf, size, "    svc(mem, ");
+            out_int(buf, size, inst[1].val);
+            out_str(buf, size, ", &mem[SP - 1]);\n");
+            break;
+        case OP_VEC_INIT:
+            out_str(buf, size, "    mem[mem[SP - 1]] = 0;\n    mem[SP - 1] = 0;\n");
+            break;
+        case OP_VEC_SIZE:
+            out_str(buf, size, "    mem[SP - 1] = mem[mem[SP - 1]];\n");
+            break;
+        case OP_VEC_GET:
+            out_str(buf, size, "    a1 = mem[SP - 2];\n    a2 = mem[SP - 1];\n");
+            emit_check(buf, size, debug, ip, "a2 < 0 || a2 >= mem[a1]");
+            out_str(buf, size, "    mem[SP - 2] = mem[a1 + a2 + 1];\n    SP -= 1;\n");
+            break;
+        case OP_VEC_SET:
+            out_str(buf, size, "    a1 = mem[SP - 3];\n    a2 = mem[SP - 2];\n");
+            emit_check(buf, size, debug, ip, "a2 < 0 || a2 >= mem[a1]");
+            out_str(buf, size, "    mem[a1 + a2 + 1] = mem[SP - 1];\n    mem[SP - 3] = mem[SP - 1];\n    SP -= 2;\n");
+            break;
+        case OP_LOAD8:
+            out_str(buf, size, "    a1 = mem[SP - 2];\n    a2 = mem[SP - 1];\n");
+            emit_check(buf, size, debug, ip, "a2 < 0 || a2 >= mem[a1]");
+            out_str(buf, size, "    mem[SP - 2] = ((unsigned char*)&mem[a1 + 1])[a2];\n    SP -= 1;\n");
+            break;
+        case OP_STORE8:
+            out_str(buf, size, "    a1 = mem[SP - 3];\n    a2 = mem[SP - 2];\n");
+            emit_check(buf, size, debug, ip, "a2 < 0 || a2 >= mem[a1]");
+            out_str(buf, size, "    ((unsigned char*)&mem[a1 + 1])[a2] = mem[SP - 1];\n    mem[SP - 3] = mem[SP - 1];\n    SP -= 2;\n");
+            break;
+        case OP_FADD:
+            emit_fbinop(buf, size, "+");
+            break;
+        case OP_FSUB:
+            emit_fbinop(buf, size, "-");
+            break;
+        case OP_FMUL:
+            emit_fbinop(buf, size, "*");
+            break;
+        case OP_FDIV:
+            emit_fbinop(buf, size, "/");
+            break;
+        case OP_FCMP:
+            out_str(buf, size, "    mem[SP - 2] = (num(mem[SP - 2]) > num(mem[SP - 1])) - (num(mem[SP - 2]) < num(mem[SP - 1]));\n    SP -= 1;\n");
+            break;
+        case OP_ITOF:
+            out_str(buf, size, "    mem[SP - 1] = bits(mem[SP - 1]);\n");
+            break;
+        case OP_FTOI:
+            out_str(buf, size, "    mem[SP - 1] = float_to_int(num(mem[SP - 1]));\n");
+            break;
+        case OP_SWITCH:
+        case OP_SEARCH:
+            out_str(buf, size, "    switch (mem[--SP]) {\n");
+            for (int k = 0, at = ip + 2; k <= inst[1].val; k++, at += 3) {
+                if (k == inst[1].val) {
+                    out_str(buf, size, "    default:\n        ");
+                } else if (mem[at + 2].val != mem[ip + 2 + 3 * inst[1].val + 2].val) {
+                    out_str(buf, size, "    case ");
+                    out_int(buf, size, mem[at + 1].val);
+                    out_str(buf, size, ":\n        ");
+                } else {
+                    continue;
+                }
+                emit_goto(buf, size, mem[at + 2].val);
+            }
+            out_str(buf, size, "    }\n");
+            break;
+        case OP_FOR:
+            out_str(buf, size, "    if (++mem[BP + ");
+            out_int(buf, size, inst[1].val);
+            out_str(buf, size, "] < ");
+            out_int(buf, size, inst[2].val);
+            out_str(buf, size, ")\n        ");
+            emit_goto(buf, size, inst[3].val);
+            break;
+        case OP_VEC_PUSH:
+            out_str(buf, size, "    a1 = mem[SP - 2];\n");
+            emit_check(buf, size, debug, ip, "a1 + mem[a1] + 1 >= MEM_SZ");
+            out_str(buf, size, "    a2 = ++mem[a1];\n    mem[a1 + a2] = mem[SP - 1];\n    mem[SP - 2] = a2;\n    SP -= 1;\n");
+            break;
+        case OP_VEC_POP:
+            out_str(buf, size, "    a1 = mem[SP - 1];\n");
+            emit_check(buf, size, debug, ip, "mem[a1] <= 0");
+            out_str(buf, size, "    mem[SP - 1] = mem[a1 + mem[a1]];\n    mem[a1]--;\n");
+            break;
+        default:
+            break;
+    }
+}
+
+// Translates the linked instruction stream into a C program: one labeled
+// block per instruction, direct gotos for jumps and calls, and a jump table
+// indexed by GLOBAL_IP for returns and for stores into GLOBAL_IP. Only the
+// return points are in the table, which keeps the control flow the C
+// compiler sees small; a store sending GLOBAL_IP anywhere else but to a
+// halt, or code rewriting its own instructions, is outside what the
+// translation keeps. The program starts from the same memory image, so it
+// writes the same Scratch.txt and sees the same addresses. Writes path.c
+// and builds path with cc -O2, returning the exit status of cc.
+int emit_c(union mem* mem, struct debug* debug, const char* path, char* buf) {
+    char src[BUF_SZ];
+    int end = mem[GLOBAL_BP].val;
+    int size = 0;
+    int n = 0;
+    for (; path[n] != '\0' && n < (int)sizeof(src) - 3; n++)
+        src[n] = path[n];
+    src[n] = '.';
+    src[n + 1] = 'c';
+    src[n + 2] = '\0';
+    int fd = open(src, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0)
+        return 1;
+    verify_decode(mem, false);
+    emit_define(buf, &size, "MEM_SZ", MEM_SZ);
+    emit_define(buf, &size, "DUMP_SZ", DUMP_SZ);
+    emit_define(buf, &size, "BUF_SZ", BUF_SZ);
+    emit_define(buf, &size, "HEAP_CLASSES", HEAP_CLASSES);
+    out_str(buf, &size, emit_prelude);
+    out_str(buf, &size, "static const int image[] = {");
+    for (int i = 0; i < end; i++) {
+        out_str(buf, &size, i % 16 == 0 ? "\n   " : "");
+        out_push(buf, &size, ' ');
+        out_int(buf, &size, mem[i].val);
+        out_push(buf, &size, ',');
+        if (size > COMP_SZ - BUF_SZ)
+            out_flush(fd, buf, &size);
+    }
+    out_str(buf, &size, "\n};\n\nint run(int* mem) {\n    int a1;\n    int a2;\n    int a3;\n    int a4;\n");
+    for (int ip = GLOB_SZ; ip < end; ip += inst_size(mem[ip].op)) {
+        emit_inst(mem, debug, buf, &size, ip);
+        if (size > COMP_SZ - BUF_SZ)
+            out_flush(fd, buf, &size);
+    }
+    emit_label(buf, &size, end);
+    out_str(buf, &size, ":\n    return 0;\ndispatch: {\n    static void* const table[] = {");
+    for (int ip = GLOB_SZ, next = GLOB_SZ, prev = OP_NULL; ip < end; ip++) {
+        out_str(buf, &size, (ip - GLOB_SZ) % 8 == 0 ? "\n       " : "");
+        if (ip == next && prev == OP_CALL) {
+            out_str(buf, &size, " &&");
+            emit_label(buf, &size, ip);
+            out_push(buf, &size, ',');
+        } else {
+            out_str(buf, &size, " &&bad,");
+        }
+        if (ip == next) {
+            prev = mem[ip].op;
+            next += inst_size(mem[ip].op);
+        }
+        if (size > COMP_SZ - BUF_SZ)
+            out_flush(fd, buf, &size);
+    }
+    out_str(buf, &size, " &&bad};\n    a1 = IP + 1;\n    if (a1 >= ");
+    out_int(buf, &size, GLOB_SZ);
+    out_str(buf, &size, " && a1 < ");
+    out_int(buf, &size, end);
+    out_str(buf, &size, ")\n        goto *table[a1 - ");
+    out_int(buf, &size, GLOB_SZ);
+    out_str(buf, &size, "];\n    if (mem[a1] == 0)\n        return 0;\n}\n");
+    out_str(buf, &size, "bad:\n    return fail(mem, \"error: jump outside the translated code (ip \", IP + 1);\n}\n\n");
+    out_str(buf, &size, emit_main);
+    out_flush(fd, buf, &size);
+    close(fd);
+    pid_t pid = fork();
+    if (pid == 0) {
+        execlp("cc", "cc", "-O2", "-o", path, src, (char*)NULL);
+        _exit(127);
+    }
+    int status;
+    waitpid(pid, &status, 0);
+    return WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+}
+
+void verify_report(struct debug* debug, char* buf) {
+    int size = 0;
+    out_str(buf, &size, "verify: ");
+    if (verifier.why == NULL) {
+        out_str(buf, &size, "ok\n");
+    } else {
+        out_str(buf, &size, verifier.why);
+        out_str(buf, &size, " at ");
+        out_loc(buf, &size, debug, verifier.at);
+        out_str(buf, &size, " (ip ");
+        out_int(buf, &size, verifier.at);
+        out_str(buf, &size, ")\n");
+    }
+    out_flush(STDERR_FILENO, buf, &size);
+}
+
+void syntax_report(const char* src, char* buf) {
+    const char* cur = NULL;
+    struct line pos;
+    int size = 0;
+    out_str(buf, &size, "error: ");
+    out_str(buf, &size, syntax.why);
+    if (syntax.at->data == NULL) {
+        out_str(buf, &size, " at the end of the file\n");
+    } else {
+        src_pos(src, &cur, syntax.at->data, &pos);
+        out_str(buf, &size, " at ");
+        out_int(buf, &size, pos.line);
+        out_push(buf, &size, ':');
+        out_int(buf, &size, pos.col);
+        out_str(buf, &size, "\n");
+    }
+    out_flush(STDERR_FILENO, buf, &size);
+}
+
+void err_report(union mem* mem, struct debug* debug, enum err err, char* buf) {
+    static const char* msgs[] = {"", "vec index out of range", "stack out of range", "address out of range", "jump to a non-instruction", "division by zero", "stack overflow", "store into the code"};
+    int size = 0;
+    int ip = mem[GLOBAL_IP].val;
+    out_str(buf, &size, "error: ");
+    out_str(buf, &size, msgs[err]);
+    out_str(buf, &size, " at ");
+    out_loc(buf, &size, debug, ip);
+    out_str(buf, &size, " (ip ");
+    out_int(buf, &size, ip);
+    out_str(buf, &size, ")\n");
+    out_flush(STDERR_FILENO, buf, &size);
+}
+
+long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+void stats_start(struct stats* stats, long* t) {
+    if (perf.on)
+        perf_read(stats->last);
+    *t = now_ns();
+}
+
+void stats_lap(struct stats* stats, enum phase phase, long* t) {
+    long now = now_ns();
+    stats->ns[phase] = now - *t;
+    *t = now;
+    if (perf.on) {
+        long counts[CNT_SZ];
+        perf_read(counts);
+        for (int i = 0; i < CNT_SZ; i++) {
+            stats->counts[phase][i] = counts[i] - stats->last[i];
+            stats->last[i] = counts[i];
+        }
+    }
+}
+
+void stats_count(struct stats* stats, struct token* tokens, struct node* nodes, union mem* mem) {
+    stats->tokens = 0;
+    while (tokens[stats->tokens].data != NULL)
+        stats->tokens++;
+    stats->nodes = 0;
+    while (nodes[stats->nodes].op != OP_NULL)
+        stats->nodes++;
+    stats->insts = mem[GLOBAL_BP].val - GLOB_SZ;
+}
+
+void out_stat(char* buf, int* size, const char* name, long x) {
+    out_str(buf, size, name);
+    out_push(buf, size, ' ');
+    out_int(buf, size, x);
+    out_push(buf, size, '\n');
+}
+
+void stats_report(struct stats* stats, char* buf) {
+    static const char* names[PHASE_SZ] = {"read_ns", "tokenize_ns", "parse_ns", "analyze_ns", "link_ns", "out_ns", "run_ns"};
+    int size = 0;
+    long compile = 0;
+    for (int i = 0; i < PHASE_SZ; i++) {
+        out_stat(buf, &size, names[i], stats->ns[i]);
+        if (i != PHASE_RUN)
+            compile += stats->ns[i];
+    }
+    out_stat(buf, &size, "compile_ns", compile);
+    out_stat(buf, &size, "bytes", stats->bytes);
+    out_stat(buf, &size, "tokens", stats->tokens);
+    out_stat(buf, &size, "nodes", stats->nodes);
+    out_stat(buf, &size, "labels", stats->labels);
+    out_stat(buf, &size, "locals", stats->locals);
+    out_stat(buf, &size, "inlined", stats->inlined);
+    out_stat(buf, &size, "ssa_fns", stats->ssa_fns);
+    out_stat(buf, &size, "gvn", stats->gvn);
+    out_stat(buf, &size, "dce", stats->dce);
+    out_stat(buf, &size, "tail_calls", stats->tail_calls);
+    out_stat(buf, &size, "hoisted", stats->hoisted);
+    out_stat(buf, &size, "reduced", stats->reduced);
+    out_stat(buf, &size, "laid_out", stats->laid_out);
+    out_stat(buf, &size, "verified", stats->verified);
+    out_stat(buf, &size, "inst_words", stats->insts);
+    out_stat(buf, &size, "code_bytes", stats->code_bytes);
+    out_stat(buf, &size, "mem_words", stats->mem_words);
+    out_stat(buf, &size, "mem_pages", stats->mem_pages);
+    out_stat(buf, &size, "heap_allocs", stats->heap_allocs);
+    out_stat(buf, &size, "heap_frees", stats->heap_frees);
+    out_stat(buf, &size, "heap_peak", stats->heap_peak);
+    out_stat(buf, &size, "heap_words", stats->heap_words);
+    if (perf.on) {
+        out_str(buf, &size, "# phase cycles instructions branch_misses l1d_misses llc_misses\n");
+        for (int i = 0; i < PHASE_SZ; i++) {
+            int n = 0;
+            while (names[i][n] != '_')
+                n++;
+            for (int j = 0; j < n; j++)
+                out_push(buf, &size, names[i][j]);
+            out_counts(buf, &size, stats->counts[i]);
+            out_push(buf, &size, '\n');
+        }
+    }
+    out_flush(STDERR_FILENO, buf, &size);
+}
+
+// Verifies the stack image and picks what runs: the image as it is when it
+// verifies, or a copy with OP_CHECK ahead of every instruction when it does
+// not or --checked asks for one. A verified image stays as it is for
+// --packed, which moves it out of mem before the run; otherwise under
+// REG_VM it is replaced by register code, generated from the same nodes.
+void load_image(union mem* mem, struct node* nodes, struct label* labels, int lab_size, struct debug* debug, const char* src, struct stats* stats, struct config* cfg, char* buf) {
+    stats->verified = verify_script(mem, debug);
+    if (cfg->verify)
+        verify_report(debug, buf);
+    cfg->checked = cfg->checked || !stats->verified;
+    if (cfg->checked) {
+        cfg->packed = false;
+        to_instructions(mem, nodes, labels, debug, src, true, cfg->compact);
+        link_instructions(mem, labels);
+        init_debug(debug, labels, lab_size);
+        verify_decode(mem, true);
+        return;
+    }
+    cfg->packed = cfg->packed && !cfg->compact && !pgo.on && !cfg->prof && can_pack(mem);
+    if (cfg->packed)
+        return;
+#ifdef REG_VM
+    int end = mem[GLOBAL_BP].val;
+    to_registers(mem, nodes, labels, debug, src);
+    for (int i = mem[GLOBAL_BP].val; i < end; i++)
+        mem[i].val = 0;
+    link_registers(mem, labels);
+    init_debug(debug, labels, lab_size);
+#endif
 }
 
-void init_script(union mem* mem) {
+bool init_script(union mem* mem, struct debug* debug, struct stats* stats, struct config* cfg) {
     char src[COMP_SZ];
     char buf[COMP_SZ];
     struct token tokens[COMP_SZ / sizeof(struct token)];
@@ -612,19 +6903,119 @@ void init_script(union mem* mem) {
     struct token* locals[COMP_SZ / sizeof(struct token)];
     int offsets[COMP_SZ / sizeof(int)];
     int lab_size = 0;
+    int size = 0;
+    long t;
 
-    read_file(src);
+    stats_start(stats, &t);
+    stats->bytes = read_file(cfg->src, src);
+    if (stats->bytes < 0) {
+        out_str(buf, &size, "error: cannot open ");
+        out_str(buf, &size, cfg->src);
+        out_str(buf, &size, "\n");
+        out_flush(STDERR_FILENO, buf, &size);
+        return false;
+    }
+    stats_lap(stats, PHASE_READ, &t);
     tokenize(src, tokens);
+    stats_lap(stats, PHASE_TOKENIZE, &t);
     parse_tokens(tokens, nodes, labels, &lab_size);
-    analyze_script(mem, nodes, locals, offsets, labels, &lab_size);
+    stats_lap(stats, PHASE_PARSE, &t);
+    if (syntax.why != NULL) {
+        syntax_report(src, buf);
+        return false;
+    }
+    pgo_init(labels, lab_size, src);
+    if (cfg->profile_in != NULL)
+        pgo_read(cfg->profile_in, buf);
+    analyze_script(mem, nodes, locals, offsets, labels, &lab_size, debug, src, stats, cfg);
+    stats_lap(stats, PHASE_ANALYZE, &t);
+    if (cfg->inline_report)
+        inline_report(labels, src, buf);
     link_instructions(mem, labels);
+    init_debug(debug, labels, lab_size);
+    if (cfg->emit_c == NULL)
+        load_image(mem, nodes, labels, lab_size, debug, src, stats, cfg, buf);
+    if (pgo.on)
+        pgo_sites();
+    stats_lap(stats, PHASE_LINK, &t);
     out_memory(mem, buf);
+    stats_lap(stats, PHASE_OUT, &t);
+    stats->labels = lab_size;
+    if (cfg->stats || cfg->perf)
+        stats_count(stats, tokens, nodes, mem);
+    return true;
+}
+
+// Runs the image with guard_handler catching faults, which come back as the
+// error it picked.
+enum err guard_run(union mem* mem, struct config* cfg) {
+    struct sigaction sa = {.sa_sigaction = guard_handler, .sa_flags = SA_SIGINFO};
+    enum err err;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGSEGV, &sa, NULL);
+    if (sigsetjmp(guard.env, 1) != 0) {
+        signal(SIGSEGV, SIG_DFL);
+        return guard.err;
+    }
+#ifdef REG_VM
+    err = cfg->packed ? run_packed(mem, packed.code) : cfg->checked ? run_script(mem) : run_registers(mem);
+#else
+    err = cfg->packed ? run_packed(mem, packed.code) : run_script(mem);
+#endif
+    signal(SIGSEGV, SIG_DFL);
+    return err;
 }
 
-void run_vm(void) {
-    static union mem mem[MEM_SZ];
-    init_script(mem);
-    run_script(mem);
+int run_vm(struct config* cfg) {
+    static struct debug debug;
+    static char buf[COMP_SZ];
+    static struct stats stats;
+    union mem* mem = arena_map(cfg->mem, cfg->huge);
+    long t;
+    int size = 0;
+    if (mem == NULL) {
+        out_str(buf, &size, "error: cannot reserve memory\n");
+        out_flush(STDERR_FILENO, buf, &size);
+        return 1;
+    }
+    if (cfg->perf)
+        perf_open();
+    pgo.on = cfg->profile_out != NULL && cfg->emit_c == NULL;
+    if (!init_script(mem, &debug, &stats, cfg))
+        return 1;
+    if (cfg->emit_c != NULL)
+        return emit_c(mem, &debug, cfg->emit_c, buf);
+    if (cfg->lines)
+        dump_lines(&debug, buf);
+    if (cfg->packed)
+        stats.code_bytes = pack_image(mem);
+    guard_image(mem);
+    if (cfg->prof)
+        prof_start(mem, &debug);
+    stats_start(&stats, &t);
+    enum err err = guard_run(mem, cfg);
+    stats_lap(&stats, PHASE_RUN, &t);
+    stats.mem_words = arena.words;
+    stats.mem_pages = arena_touched();
+    stats.heap_allocs = heap.allocs;
+    stats.heap_frees = heap.frees;
+    stats.heap_peak = heap.peak;
+    stats.heap_words = heap.top - heap.lo;
+    if (err != ERR_NONE && cfg->packed)
+        mem[GLOBAL_IP].val = packed.word[mem[GLOBAL_IP].val];
+    if (pgo.on)
+        pgo_write(mem, cfg->profile_out, buf);
+    if (cfg->prof) {
+        prof_stop();
+        prof_report(&debug, buf);
+    }
+    if (cfg->stats || cfg->perf)
+        stats_report(&stats, buf);
+    if (err != ERR_NONE) {
+        err_report(mem, &debug, err, buf);
+        return 1;
+    }
+    return 0;
 }
 
 void init_rlimit(void) {
@@ -632,8 +7023,55 @@ void init_rlimit(void) {
     setrlimit(RLIMIT_STACK, &rlim);
 }
 
-int main(void) {
+void init_config(struct config* cfg, int argc, char** argv) {
+    *cfg = (struct config){.src = SRC, .inline_max = INLINE_MAX, .mem = MEM_MAX};
+    for (int i = 1; i < argc; i++) {
+        if (str_eq(argv[i], "--prof"))
+            cfg->prof = true;
+        else if (str_eq(argv[i], "--lines"))
+            cfg->lines = true;
+        else if (str_eq(argv[i], "--stats"))
+            cfg->stats = true;
+        else if (str_eq(argv[i], "--perf"))
+            cfg->perf = true;
+        else if (str_eq(argv[i], "--inline") && i + 1 < argc)
+            cfg->inline_max = str_to_int(argv[++i]);
+        else if (str_eq(argv[i], "--inline-report"))
+            cfg->inline_report = true;
+        else if (str_eq(argv[i], "--no-tail"))
+            cfg->no_tail = true;
+        else if (str_eq(argv[i], "--no-loops"))
+            cfg->no_loops = true;
+        else if (str_eq(argv[i], "--no-ssa"))
+            cfg->no_ssa = true;
+        else if (str_eq(argv[i], "--checked"))
+            cfg->checked = true;
+        else if (str_eq(argv[i], "--verify"))
+            cfg->verify = true;
+        else if (str_eq(argv[i], "--packed"))
+            cfg->packed = true;
+        else if (str_eq(argv[i], "--compact"))
+            cfg->compact = true;
+        else if (str_eq(argv[i], "--mem") && i + 1 < argc)
+            cfg->mem = str_to_int(argv[++i]);
+        else if (str_eq(argv[i], "--huge"))
+            cfg->huge = true;
+        else if (str_eq(argv[i], "--emit-c") && i + 1 < argc)
+            cfg->emit_c = argv[++i];
+        else if (str_eq(argv[i], "--profile-in") && i + 1 < argc)
+            cfg->profile_in = argv[++i];
+        else if (str_eq(argv[i], "--profile-out") && i + 1 < argc)
+            cfg->profile_out = argv[++i];
+        else
+            cfg->src = argv[i];
+    }
+    if (cfg->mem < MEM_SZ)
+        cfg->mem = MEM_SZ;
+}
+
+int main(int argc, char** argv) {
+    struct config cfg;
     init_rlimit();
-    run_vm();
-    return 0;
+    init_config(&cfg, argc, argv);
+    return run_vm(&cfg);
 }